@@ -0,0 +1,73 @@
+#ifndef _COMMON_MAPPED_FILE_H_
+#define _COMMON_MAPPED_FILE_H_
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+
+namespace common {
+
+// Read-only mmap of a whole file, shared by the dblisp and mydiff
+// libraries. An empty file maps to a null range.
+// `advice` is passed to madvise(), MADV_SEQUENTIAL for a single pass.
+class MappedFile {
+ public:
+  MappedFile() : data_(nullptr), size_(0) {}
+
+  ~MappedFile() { close(); }
+
+  MappedFile(const MappedFile&) = delete;
+
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  bool open(const std::string& file, const int advice = MADV_NORMAL) {
+    close();
+    int fd = ::open(file.c_str(), O_RDONLY);
+    if (fd < 0) {
+      return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+      ::close(fd);
+      return false;
+    }
+    size_ = static_cast<size_t>(st.st_size);
+    if (size_ != 0) {
+      void* addr = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (addr == MAP_FAILED) {
+        ::close(fd);
+        size_ = 0;
+        return false;
+      }
+      if (advice != MADV_NORMAL) {
+        madvise(addr, size_, advice);
+      }
+      data_ = static_cast<const char*>(addr);
+    }
+    ::close(fd);
+    return true;
+  }
+
+  void close() {
+    if (data_ != nullptr) {
+      munmap(const_cast<char*>(data_), size_);
+    }
+    data_ = nullptr;
+    size_ = 0;
+  }
+
+  const char* data() const { return data_; }
+
+  size_t size() const { return size_; }
+
+ private:
+  const char* data_;
+  size_t size_;
+};
+
+}  // namespace common
+
+#endif
@@ -0,0 +1,236 @@
+#ifndef _MYDIFF_ANCHORED_DIFF_H_
+#define _MYDIFF_ANCHORED_DIFF_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <unordered_map>
+#include <vector>
+
+#include "bounded-diff.h"
+#include "edit-runs.h"
+#include "myers-diff.h"
+#include "thread-pool.h"
+#include "trace.h"
+
+namespace mydiff {
+
+// Splits a diff at anchors and diffs the pieces independently. Anchors are
+// lines that occur exactly once in each input; the longest chain of them in
+// the same order on both sides (an LIS over their destination positions) is
+// retained as is, and the segments between consecutive anchors go to the
+// Myers engine one by one, on a thread pool when one is given. Every
+// segment is much smaller than the whole, so the work parallelises and each
+// engine workspace stays small. As with patience diff, the script keeps the
+// anchors even where a shortest script would not, so it can be a little
+// longer than the unanchored one.
+template <typename RIter,
+          typename EqualTo = std::equal_to<
+              typename std::iterator_traits<RIter>::value_type>,
+          typename Hash =
+              std::hash<typename std::iterator_traits<RIter>::value_type>>
+class AnchoredDiff {
+  typedef iter_dif_t<RIter> diff_t;
+  typedef typename std::iterator_traits<RIter>::value_type value_type;
+  typedef MyersDiff<RIter, EqualTo> engine_t;
+
+  // Segments are grouped into pool tasks of at least this many lines.
+  enum { MIN_TASK_LINES = 1 << 14 };
+
+  struct Occurrence {
+    uint32_t srcCount;
+    uint32_t dstCount;
+    diff_t srcIndex;
+    diff_t dstIndex;
+  };
+
+  struct Segment {
+    diff_t srcFirst;
+    diff_t srcLast;
+    diff_t dstFirst;
+    diff_t dstLast;
+  };
+
+ public:
+  // `pool` may be null to diff the segments on the calling thread, which
+  // callers already running on a pool must do. A non-zero `maxMemory`
+  // bounds each segment as in boundedEditScript().
+  explicit AnchoredDiff(ThreadPool* pool, const uint64_t maxMemory = 0,
+                        const EqualTo& equalTo = EqualTo())
+      : pool_(pool), maxMemory_(maxMemory), equalTo_(equalTo) {}
+
+  typedef std::vector<std::pair<diff_t, diff_t>> anchors_t;
+
+  diff_t diff(RIter first1, RIter last1, RIter first2, RIter last2,
+              edit_runs_t& runs) {
+    anchors_t anchors;
+    {
+      TraceScope trace("anchors");
+      findAnchors(first1, last1, first2, last2, anchors);
+      trace.arg("anchors", anchors.size());
+    }
+    return diff(first1, last1, first2, last2, anchors, runs);
+  }
+
+  // Diffs around `anchors`, (source, destination) index pairs of equal lines
+  // increasing on both sides, for callers that find them another way.
+  diff_t diff(RIter first1, RIter last1, RIter first2, RIter last2,
+              const anchors_t& anchors, edit_runs_t& runs) {
+    std::vector<Segment> segments;
+    diff_t srcIndex = 0, dstIndex = 0;
+    for (const auto& anchor : anchors) {
+      segments.push_back(
+          Segment{srcIndex, anchor.first, dstIndex, anchor.second});
+      srcIndex = anchor.first + 1;
+      dstIndex = anchor.second + 1;
+    }
+    segments.push_back(
+        Segment{srcIndex, last1 - first1, dstIndex, last2 - first2});
+
+    std::vector<edit_runs_t> segmentRuns(segments.size());
+    std::vector<diff_t> segmentLcs(segments.size(), 0);
+    size_t workers = pool_ == nullptr ? 1 : pool_->size();
+    std::vector<engine_t> engines(workers);
+    auto diffSegments = [&](size_t first, size_t last, size_t worker) {
+      for (size_t i = first; i != last; ++i) {
+        const Segment& segment = segments[i];
+        segmentLcs[i] = diffSegment(
+            first1 + segment.srcFirst, first1 + segment.srcLast,
+            first2 + segment.dstFirst, first2 + segment.dstLast,
+            engines[worker], segmentRuns[i]);
+      }
+    };
+    for (size_t first = 0, last = 0; first != segments.size(); first = last) {
+      diff_t lines = 0;
+      for (; last != segments.size() && lines < MIN_TASK_LINES; ++last) {
+        lines += (segments[last].srcLast - segments[last].srcFirst) +
+                 (segments[last].dstLast - segments[last].dstFirst);
+      }
+      if (pool_ == nullptr) {
+        diffSegments(first, last, 0);
+      } else {
+        pool_->submit([&diffSegments, first, last](size_t worker) {
+          diffSegments(first, last, worker);
+        });
+      }
+    }
+    if (pool_ != nullptr) {
+      pool_->wait();
+    }
+
+    edit_runs_t runsTemp;
+    diff_t lcs = anchors.size();
+    for (size_t i = 0; i != segments.size(); ++i) {
+      for (const auto& run : segmentRuns[i]) {
+        appendRun(runsTemp, run.op, run.count);
+      }
+      lcs += segmentLcs[i];
+      if (i != anchors.size()) {
+        appendRun(runsTemp, ES_RETAIN, 1);
+      }
+    }
+    runs.swap(runsTemp);
+    return lcs;
+  }
+
+ private:
+  // Longest chain of lines unique on both sides that is increasing in both
+  // source and destination position.
+  void findAnchors(RIter first1, RIter last1, RIter first2, RIter last2,
+                   anchors_t& anchors) const {
+    std::unordered_map<value_type, Occurrence, Hash, EqualTo> occurrences(
+        (last1 - first1) + (last2 - first2), Hash(), equalTo_);
+    for (RIter iter = first1; iter != last1; ++iter) {
+      Occurrence& occurrence =
+          occurrences.emplace(*iter, Occurrence{0, 0, 0, 0}).first->second;
+      occurrence.srcCount += 1;
+      occurrence.srcIndex = iter - first1;
+    }
+    for (RIter iter = first2; iter != last2; ++iter) {
+      auto found = occurrences.find(*iter);
+      if (found != occurrences.end()) {
+        found->second.dstCount += 1;
+        found->second.dstIndex = iter - first2;
+      }
+    }
+    anchors_t unique;
+    for (RIter iter = first1; iter != last1; ++iter) {
+      const Occurrence& occurrence = occurrences.find(*iter)->second;
+      if (occurrence.srcCount == 1 && occurrence.dstCount == 1) {
+        unique.push_back(
+            std::make_pair(occurrence.srcIndex, occurrence.dstIndex));
+      }
+    }
+    longestChain(unique, anchors);
+  }
+
+ public:
+  // Longest subsequence of `unique`, pairs in increasing source order, that
+  // also increases in destination order.
+  static void longestChain(const anchors_t& unique, anchors_t& anchors) {
+    // Patience sorting: tails[k] ends the best chain of length k + 1 found
+    // so far, and each element remembers its predecessor in its chain.
+    std::vector<size_t> tails;
+    std::vector<size_t> previous(unique.size());
+    for (size_t i = 0; i != unique.size(); ++i) {
+      auto pos = std::lower_bound(
+          tails.begin(), tails.end(), unique[i].second,
+          [&unique](size_t k, diff_t dst) { return unique[k].second < dst; });
+      previous[i] = pos == tails.begin() ? i : *(pos - 1);
+      if (pos == tails.end()) {
+        tails.push_back(i);
+      } else {
+        *pos = i;
+      }
+    }
+    anchors_t anchorsTemp(tails.size());
+    for (size_t k = tails.size(), i = tails.empty() ? 0 : tails.back(); k != 0;
+         --k, i = previous[i]) {
+      anchorsTemp[k - 1] = unique[i];
+    }
+    anchors.swap(anchorsTemp);
+  }
+
+ private:
+  diff_t diffSegment(RIter first1, RIter last1, RIter first2, RIter last2,
+                     engine_t& engine, edit_runs_t& runs) const {
+    if (maxMemory_ != 0) {
+      return boundedEditScript(first1, last1, first2, last2, maxMemory_, runs,
+                               equalTo_);
+    }
+    ses_t<RIter> ses;
+    diff_t lcs = engine.diff(first1, last1, first2, last2, ses, equalTo_);
+    compactSes(ses, runs);
+    return lcs;
+  }
+
+  static void appendRun(edit_runs_t& runs, const EDIT_SCRIPT op,
+                        const uint64_t count) {
+    if (!runs.empty() && runs.back().op == op) {
+      runs.back().count += count;
+    } else {
+      runs.push_back(EditRun{op, count});
+    }
+  }
+
+ private:
+  ThreadPool* pool_;
+  uint64_t maxMemory_;
+  EqualTo equalTo_;
+};
+
+// Runs of the anchored diff of [first1, last1) and [first2, last2),
+// returning the number of retained lines.
+template <typename RIter>
+iter_dif_t<RIter> anchoredEditScript(RIter first1, RIter last1, RIter first2,
+                                     RIter last2, ThreadPool* pool,
+                                     const uint64_t maxMemory,
+                                     edit_runs_t& runs) {
+  return AnchoredDiff<RIter>(pool, maxMemory)
+      .diff(first1, last1, first2, last2, runs);
+}
+
+}  // namespace mydiff
+
+#endif
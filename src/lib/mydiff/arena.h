@@ -0,0 +1,120 @@
+#ifndef _MYDIFF_ARENA_H_
+#define _MYDIFF_ARENA_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <vector>
+
+namespace mydiff {
+
+// Monotonic bump allocator for one diff job. Memory is carved from blocks
+// that grow geometrically, deallocation is a no-op and release() or the
+// destructor frees everything at once. It takes no lock, so a job must keep
+// its arena to a single thread; concurrent jobs each own an arena.
+class MonotonicArena {
+ public:
+  explicit MonotonicArena(const size_t initialSize = 64 << 10)
+      : nextSize_(initialSize), cur_(nullptr), left_(0), allocated_(0) {}
+
+  ~MonotonicArena() { release(); }
+
+  MonotonicArena(const MonotonicArena&) = delete;
+
+  MonotonicArena& operator=(const MonotonicArena&) = delete;
+
+  void* allocate(const size_t size, const size_t align) {
+    size_t pad = (align - reinterpret_cast<uintptr_t>(cur_) % align) % align;
+    if (cur_ == nullptr || pad + size > left_) {
+      newBlock(size + align);
+      pad = (align - reinterpret_cast<uintptr_t>(cur_) % align) % align;
+    }
+    char* ptr = cur_ + pad;
+    cur_ = ptr + size;
+    left_ -= pad + size;
+    return ptr;
+  }
+
+  void release() {
+    for (auto block : blocks_) {
+      ::operator delete(block);
+    }
+    blocks_.clear();
+    cur_ = nullptr;
+    left_ = 0;
+    allocated_ = 0;
+  }
+
+  // Bytes obtained from the system, including unused block tails.
+  size_t allocated() const { return allocated_; }
+
+ private:
+  void newBlock(const size_t minSize) {
+    size_t size = nextSize_ < minSize ? minSize : nextSize_;
+    blocks_.reserve(blocks_.size() + 1);
+    cur_ = static_cast<char*>(::operator new(size));
+    blocks_.push_back(cur_);
+    left_ = size;
+    allocated_ += size;
+    nextSize_ = size * 2;
+  }
+
+ private:
+  std::vector<void*> blocks_;
+  size_t nextSize_;
+  char* cur_;
+  size_t left_;
+  size_t allocated_;
+};
+
+// Standard allocator over a MonotonicArena. A default constructed allocator
+// has no arena and falls back to the global heap, so containers can switch
+// between the two at run time without changing type.
+template <typename T>
+class ArenaAllocator {
+  template <typename U>
+  friend class ArenaAllocator;
+
+ public:
+  typedef T value_type;
+
+  ArenaAllocator() : arena_(nullptr) {}
+
+  explicit ArenaAllocator(MonotonicArena* arena) : arena_(arena) {}
+
+  template <typename U>
+  ArenaAllocator(const ArenaAllocator<U>& x) : arena_(x.arena_) {}
+
+  T* allocate(const size_t n) {
+    if (arena_ == nullptr) {
+      return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+    return static_cast<T*>(arena_->allocate(n * sizeof(T), alignof(T)));
+  }
+
+  void deallocate(T* ptr, size_t) {
+    if (arena_ == nullptr) {
+      ::operator delete(ptr);
+    }
+  }
+
+  MonotonicArena* arena() const { return arena_; }
+
+  template <typename U>
+  bool operator==(const ArenaAllocator<U>& x) const {
+    return arena_ == x.arena_;
+  }
+
+  template <typename U>
+  bool operator!=(const ArenaAllocator<U>& x) const {
+    return arena_ != x.arena_;
+  }
+
+ private:
+  MonotonicArena* arena_;
+};
+
+}  // namespace mydiff
+
+#endif
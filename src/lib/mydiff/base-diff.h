@@ -0,0 +1,151 @@
+#ifndef _MYDIFF_BASE_DIFF_H_
+#define _MYDIFF_BASE_DIFF_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <unordered_map>
+#include <vector>
+
+#include "anchored-diff.h"
+#include "bounded-diff.h"
+#include "edit-runs.h"
+#include "myers-diff.h"
+#include "trace.h"
+
+namespace mydiff {
+
+// Diffs one base against many targets. The base is indexed once: every
+// distinct line with its number of occurrences and, for lines that occur
+// once, its position. Anchoring a target against it then takes one lookup
+// per target line and a scan of the target's own hits, where a standalone
+// AnchoredDiff rebuilds the table over both inputs for every pair.
+//
+// diff() is const and may run on many threads at once, each with its own
+// Workspace. The result is the one AnchoredDiff, boundedEditScript() or the
+// Myers engine gives for the same pair and options.
+template <typename RIter,
+          typename EqualTo = std::equal_to<
+              typename std::iterator_traits<RIter>::value_type>,
+          typename Hash =
+              std::hash<typename std::iterator_traits<RIter>::value_type>>
+class BaseDiff {
+  typedef iter_dif_t<RIter> diff_t;
+  typedef typename std::iterator_traits<RIter>::value_type value_type;
+  typedef AnchoredDiff<RIter, EqualTo, Hash> anchored_t;
+  typedef typename anchored_t::anchors_t anchors_t;
+
+  struct BaseLine {
+    uint32_t count;
+    diff_t index;
+  };
+
+ public:
+  // Per-thread state: a warm engine and the target side counts of the base
+  // lines, indexed by base position and cleared after each diff.
+  class Workspace {
+    friend class BaseDiff;
+
+    MyersDiff<RIter, EqualTo> engine_;
+    std::vector<uint32_t> counts_;
+    std::vector<diff_t> positions_;
+    std::vector<diff_t> hits_;
+  };
+
+  // Without `anchor` the targets go to the plain engine, or to the bounded
+  // one under a non-zero `maxMemory`, and only the lines are shared.
+  BaseDiff(RIter first, RIter last, const bool anchor,
+           const uint64_t maxMemory = 0, const EqualTo& equalTo = EqualTo())
+      : first_(first),
+        last_(last),
+        anchor_(anchor),
+        maxMemory_(maxMemory),
+        equalTo_(equalTo),
+        lines_(0, Hash(), equalTo) {
+    if (anchor_) {
+      TraceScope trace("base index", "N", last - first);
+      lines_.reserve(last - first);
+      for (RIter iter = first; iter != last; ++iter) {
+        BaseLine& line = lines_.emplace(*iter, BaseLine{0, 0}).first->second;
+        line.count += 1;
+        line.index = iter - first;
+      }
+    }
+  }
+
+  BaseDiff(const BaseDiff&) = delete;
+
+  BaseDiff& operator=(const BaseDiff&) = delete;
+
+  // Runs of the script from the base to [first2, last2), returning the
+  // number of retained lines.
+  diff_t diff(RIter first2, RIter last2, Workspace& workspace,
+              edit_runs_t& runs) const {
+    if (anchor_) {
+      anchors_t anchors;
+      {
+        TraceScope trace("anchors");
+        findAnchors(first2, last2, workspace, anchors);
+        trace.arg("anchors", anchors.size());
+      }
+      return anchored_t(nullptr, maxMemory_, equalTo_)
+          .diff(first_, last_, first2, last2, anchors, runs);
+    }
+    if (maxMemory_ != 0) {
+      return boundedEditScript(first_, last_, first2, last2, maxMemory_, runs,
+                               equalTo_);
+    }
+    ses_t<RIter> ses;
+    diff_t lcs = workspace.engine_.diff(first_, last_, first2, last2, ses,
+                                        equalTo_);
+    compactSes(ses, runs);
+    return lcs;
+  }
+
+ private:
+  // Same anchors as AnchoredDiff::findAnchors(): lines unique on both sides,
+  // chained by longest increasing destination position.
+  void findAnchors(RIter first2, RIter last2, Workspace& workspace,
+                   anchors_t& anchors) const {
+    std::vector<uint32_t>& counts = workspace.counts_;
+    std::vector<diff_t>& positions = workspace.positions_;
+    std::vector<diff_t>& hits = workspace.hits_;
+    counts.resize(last_ - first_, 0);
+    positions.resize(last_ - first_, 0);
+    hits.clear();
+    for (RIter iter = first2; iter != last2; ++iter) {
+      auto found = lines_.find(*iter);
+      if (found == lines_.end() || found->second.count != 1) {
+        continue;
+      }
+      diff_t index = found->second.index;
+      if (counts[index] == 0) {
+        hits.push_back(index);
+      }
+      counts[index] += 1;
+      positions[index] = iter - first2;
+    }
+    std::sort(hits.begin(), hits.end());
+    anchors_t unique;
+    for (diff_t index : hits) {
+      if (counts[index] == 1) {
+        unique.push_back(std::make_pair(index, positions[index]));
+      }
+      counts[index] = 0;
+    }
+    anchored_t::longestChain(unique, anchors);
+  }
+
+ private:
+  RIter first_;
+  RIter last_;
+  bool anchor_;
+  uint64_t maxMemory_;
+  EqualTo equalTo_;
+  std::unordered_map<value_type, BaseLine, Hash, EqualTo> lines_;
+};
+
+}  // namespace mydiff
+
+#endif
@@ -0,0 +1,334 @@
+#ifndef _MYDIFF_BINARY_PATCH_H_
+#define _MYDIFF_BINARY_PATCH_H_
+
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include "edit-runs.h"
+#include "line-interner.h"
+#include "line-reader.h"
+#include "mapped-file.h"
+#include "move-detector.h"
+#include "sha256.h"
+
+namespace mydiff {
+
+// Compact binary delta between a base and a target file.
+//
+//   "MYDP" version flags baseLines baseDigest[32]
+//   run*  where run = varint((count << 2) | op)
+//                     op RETAIN/DELETE consume `count` base lines,
+//                     op INSERT is followed by `count` x (varint size, bytes)
+//                     op MOVE copies `count` base lines starting at the
+//                     following varint line index
+//   varint(RUN_END) targetDigest[32]
+//
+// Integers are LEB128 varints. Both digests are SHA-256 over the raw file
+// bytes. MOVE shares its op with RUN_END and is told apart by a non-zero
+// count; patches without moves are written as version 1. The runs are in
+// target order, so a patch is applied in one sequential pass over base and
+// patch with memory bounded by the longest line; only a patch with moves
+// also maps the base to copy lines from anywhere in it.
+class BinaryPatch {
+  enum { RUN_RETAIN = 0, RUN_DELETE = 1, RUN_INSERT = 2, RUN_END = 3 };
+  enum { RUN_MOVE = RUN_END };
+  enum { PATCH_VERSION = 2, MIN_PATCH_VERSION = 1 };
+  enum { FLAG_NO_FINAL_NEWLINE = 1 };
+  enum { INSERT_PIECE = 64 << 10 };
+
+ public:
+  template <typename LineVector>
+  static bool write(std::ostream& out, const std::string& baseFile,
+                    const std::string& targetFile, const edit_runs_t& runs,
+                    const LineVector& target) {
+    return write(out, baseFile, targetFile, runs, target, moves_t());
+  }
+
+  // As above, with the exact blocks of `moves` sent as references to the
+  // base instead of their bytes.
+  template <typename LineVector>
+  static bool write(std::ostream& out, const std::string& baseFile,
+                    const std::string& targetFile, const edit_runs_t& runs,
+                    const LineVector& target, const moves_t& moves) {
+    unsigned char baseDigest[Sha256::DIGEST_SIZE];
+    unsigned char targetDigest[Sha256::DIGEST_SIZE];
+    if (!Sha256::digestFile(baseFile, baseDigest)) {
+      return errorLog("read error on " + baseFile);
+    }
+    if (!Sha256::digestFile(targetFile, targetDigest)) {
+      return errorLog("read error on " + targetFile);
+    }
+    return write(out, baseDigest, targetDigest, lacksFinalNewline(targetFile),
+                 runs, target, moves);
+  }
+
+  // As above for inputs held in memory, such as those of a FileCache: the
+  // digests and the target's final newline are those the runs were
+  // computed from, rather than read again from files that may have changed.
+  template <typename LineVector>
+  static bool write(std::ostream& out, const unsigned char* baseDigest,
+                    const unsigned char* targetDigest,
+                    const bool targetLacksFinalNewline,
+                    const edit_runs_t& runs, const LineVector& target,
+                    const moves_t& moves) {
+    moves_t exactMoves;
+    for (const auto& move : moves) {
+      if (move.exact) exactMoves.push_back(move);
+    }
+    uint64_t baseLines = 0;
+    for (const auto& run : runs) {
+      if (run.op != ES_INSERT) baseLines += run.count;
+    }
+    out.write("MYDP", 4);
+    putVarint(out, exactMoves.empty() ? MIN_PATCH_VERSION : PATCH_VERSION);
+    putVarint(out, targetLacksFinalNewline ? FLAG_NO_FINAL_NEWLINE : 0);
+    putVarint(out, baseLines);
+    out.write(reinterpret_cast<const char*>(baseDigest), Sha256::DIGEST_SIZE);
+    size_t targetIndex = 0;
+    auto move = exactMoves.begin();
+    uint64_t moveLeft = 0;
+    for (const auto& run : runs) {
+      switch (run.op) {
+        case ES_RETAIN:
+          putVarint(out, (run.count << 2) | RUN_RETAIN);
+          targetIndex += run.count;
+          break;
+        case ES_DELETE:
+          putVarint(out, (run.count << 2) | RUN_DELETE);
+          break;
+        case ES_INSERT:
+          for (size_t end = targetIndex + run.count; targetIndex != end;) {
+            if (move != exactMoves.end() && move->dstIndex == targetIndex) {
+              putVarint(out, (move->count << 2) | RUN_MOVE);
+              putVarint(out, move->srcIndex);
+              moveLeft = move->count;
+              ++move;
+            }
+            // A block may span insert runs split by deletes, which produce
+            // no output, so the whole block is sent where it starts.
+            if (moveLeft != 0) {
+              uint64_t skip = std::min<uint64_t>(moveLeft, end - targetIndex);
+              targetIndex += skip;
+              moveLeft -= skip;
+              continue;
+            }
+            size_t stop = move != exactMoves.end() && move->dstIndex < end
+                              ? move->dstIndex
+                              : end;
+            putVarint(out, ((stop - targetIndex) << 2) | RUN_INSERT);
+            for (; targetIndex != stop; ++targetIndex) {
+              putVarint(out, target[targetIndex]->size);
+              out.write(target[targetIndex]->data, target[targetIndex]->size);
+            }
+          }
+          break;
+        default:;
+      }
+    }
+    putVarint(out, RUN_END);
+    out.write(reinterpret_cast<const char*>(targetDigest),
+              Sha256::DIGEST_SIZE);
+    return out.good() ? true : errorLog("write error");
+  }
+
+  // True for a non-empty file whose last byte is not a newline.
+  static bool lacksFinalNewline(const std::string& file) {
+    int fd = ::open(file.c_str(), O_RDONLY);
+    if (fd < 0) {
+      return false;
+    }
+    struct stat st;
+    char last = '\n';
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+      if (pread(fd, &last, 1, st.st_size - 1) != 1) last = '\n';
+    }
+    ::close(fd);
+    return last != '\n';
+  }
+
+  // Rebuilds the target from `baseFile` and the patch read from `patch`.
+  // Fails if the base or the produced target does not match the digests in
+  // the patch; the output is complete but must then be discarded.
+  static bool apply(const std::string& baseFile, std::istream& patch,
+                    std::ostream& out) {
+    char magic[4];
+    uint64_t version, flags, baseLines;
+    unsigned char baseDigest[Sha256::DIGEST_SIZE];
+    if (!patch.read(magic, 4) || std::memcmp(magic, "MYDP", 4) != 0 ||
+        !getVarint(patch, version) || version < MIN_PATCH_VERSION ||
+        version > PATCH_VERSION ||
+        !getVarint(patch, flags) || !getVarint(patch, baseLines) ||
+        !patch.read(reinterpret_cast<char*>(baseDigest), sizeof(baseDigest))) {
+      return errorLog("not a mydiff patch");
+    }
+    LineReader base;
+    if (!base.open(baseFile)) {
+      return errorLog("open error on " + baseFile);
+    }
+    Sha256 targetSha;
+    bool firstLine = true;
+    uint64_t baseIndex = 0;
+    const char* data;
+    size_t size;
+    std::string payload;
+    MappedFile baseMap;
+    std::vector<size_t> baseStarts;
+    auto startLine = [&]() {
+      if (!firstLine) {
+        out.put('\n');
+        targetSha.update("\n", 1);
+      }
+      firstLine = false;
+    };
+    auto emit = [&](const char* line, const size_t lineSize) {
+      out.write(line, lineSize);
+      targetSha.update(line, lineSize);
+    };
+    for (uint64_t tag;;) {
+      if (!getVarint(patch, tag)) {
+        return errorLog("truncated patch");
+      }
+      uint64_t count = tag >> 2;
+      if ((tag & 3) == RUN_END && count == 0) {
+        break;
+      }
+      switch (tag & 3) {
+        case RUN_RETAIN:
+        case RUN_DELETE:
+          for (uint64_t i = 0; i != count; ++i, ++baseIndex) {
+            if (!base.next(data, size)) {
+              return errorLog("base is shorter than the patch expects");
+            }
+            if ((tag & 3) == RUN_RETAIN) {
+              startLine();
+              emit(data, size);
+            }
+          }
+          break;
+        case RUN_INSERT:
+          for (uint64_t i = 0; i != count; ++i) {
+            if (!getVarint(patch, size)) {
+              return errorLog("truncated patch");
+            }
+            // Copied in pieces, so that a corrupt size fails at the end of
+            // the patch instead of allocating it up front.
+            startLine();
+            for (size_t piece; size != 0; size -= piece) {
+              piece = std::min<size_t>(size, INSERT_PIECE);
+              payload.resize(piece);
+              if (!patch.read(&payload[0], piece)) {
+                return errorLog("truncated patch");
+              }
+              emit(payload.data(), piece);
+            }
+          }
+          break;
+        case RUN_MOVE: {
+          uint64_t first;
+          if (!getVarint(patch, first)) {
+            return errorLog("truncated patch");
+          }
+          if (baseStarts.empty() &&
+              !indexLines(baseFile, baseMap, baseStarts)) {
+            return errorLog("read error on " + baseFile);
+          }
+          if (first > baseStarts.size() - 1 ||
+              count > baseStarts.size() - 1 - first) {
+            return errorLog("move outside the base");
+          }
+          for (uint64_t i = first; i != first + count; ++i) {
+            size_t end = baseStarts[i + 1];
+            if (end != baseStarts[i] && baseMap.data()[end - 1] == '\n') {
+              end -= 1;
+            }
+            startLine();
+            emit(baseMap.data() + baseStarts[i], end - baseStarts[i]);
+          }
+          break;
+        }
+        default:;
+      }
+    }
+    if (!firstLine && (flags & FLAG_NO_FINAL_NEWLINE) == 0) {
+      out.put('\n');
+      targetSha.update("\n", 1);
+    }
+    unsigned char expected[Sha256::DIGEST_SIZE];
+    unsigned char actual[Sha256::DIGEST_SIZE];
+    if (!patch.read(reinterpret_cast<char*>(expected), sizeof(expected))) {
+      return errorLog("truncated patch");
+    }
+    if (baseIndex != baseLines || base.next(data, size) || !base.drain()) {
+      return errorLog("base does not match the patch");
+    }
+    base.digest(actual);
+    if (std::memcmp(actual, baseDigest, sizeof(actual)) != 0) {
+      return errorLog("base checksum mismatch");
+    }
+    targetSha.final(actual);
+    if (std::memcmp(actual, expected, sizeof(actual)) != 0) {
+      return errorLog("target checksum mismatch");
+    }
+    return out.flush().good() ? true : errorLog("write error");
+  }
+
+ private:
+  // Maps `file` and records where each line starts, plus one entry for the
+  // end of the file, so line i spans starts[i] to starts[i + 1].
+  static bool indexLines(const std::string& file, MappedFile& mapped,
+                         std::vector<size_t>& starts) {
+    if (!mapped.open(file)) {
+      return false;
+    }
+    starts.clear();
+    const char* data = mapped.data();
+    for (size_t pos = 0; pos != mapped.size();) {
+      starts.push_back(pos);
+      const char* newline = static_cast<const char*>(
+          std::memchr(data + pos, '\n', mapped.size() - pos));
+      pos = newline == nullptr ? mapped.size() : newline - data + 1;
+    }
+    starts.push_back(mapped.size());
+    return true;
+  }
+
+  template <typename Int>
+  static bool getVarint(std::istream& in, Int& value) {
+    uint64_t result = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+      int c = in.get();
+      if (c == EOF) {
+        return false;
+      }
+      result |= uint64_t(c & 0x7f) << shift;
+      if ((c & 0x80) == 0) {
+        value = static_cast<Int>(result);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  static void putVarint(std::ostream& out, uint64_t value) {
+    char bytes[10];
+    int n = 0;
+    for (; value >= 0x80; value >>= 7) {
+      bytes[n++] = static_cast<char>((value & 0x7f) | 0x80);
+    }
+    bytes[n++] = static_cast<char>(value);
+    out.write(bytes, n);
+  }
+
+  static bool errorLog(const std::string& logInfo) {
+    std::cerr << "mydiff: patch: " << logInfo << std::endl;
+    return false;
+  }
+};
+
+}  // namespace mydiff
+
+#endif
@@ -0,0 +1,185 @@
+#ifndef _MYDIFF_BOUNDED_DIFF_H_
+#define _MYDIFF_BOUNDED_DIFF_H_
+
+#include <cstdint>
+#include <functional>
+
+#include "edit-runs.h"
+#include "myers-diff.h"
+
+namespace mydiff {
+
+// Diff under a hard memory budget for the engine workspace and the edit
+// script. The common prefix and suffix are peeled off first. If the rest fits
+// the budget it is diffed in one piece, which gives exactly the unbounded
+// result. Otherwise both sides are cut into chunk pairs small enough to fit,
+// each cut placed on a matching line near the proportional position when one
+// exists, and the chunks are diffed one after another. Edits only ever leave
+// as runs through `sink(op, count)`, so the full SES never exists in memory;
+// the price is that a chunked script may be longer than the shortest one.
+template <typename RIter, typename EqualTo>
+class BoundedDiff {
+  typedef iter_dif_t<RIter> diff_t;
+  typedef ses_t<RIter> script_t;
+  typedef std::function<void(EDIT_SCRIPT, uint64_t)> sink_t;
+
+  // Both V arrays plus the worst-case SES, per element of N + M.
+  enum {
+    BYTES_PER_ELEMENT = 2 * sizeof(diff_t) + sizeof(ses_value_t<RIter>)
+  };
+  enum { MIN_CHUNK = 256, ANCHOR_PROBES = 8 };
+
+ public:
+  BoundedDiff(const uint64_t maxMemory, const EqualTo& equalTo)
+      : maxChunk_(chunkLimit(maxMemory)), equalTo_(equalTo) {}
+
+  // Largest N + M diffed in one piece under `maxMemory` bytes. A budget
+  // below minMemory() still gets chunks of MIN_CHUNK elements, so callers
+  // taking a budget from users check it against minMemory() first.
+  static diff_t chunkLimit(const uint64_t maxMemory) {
+    diff_t limit = static_cast<diff_t>(maxMemory / BYTES_PER_ELEMENT);
+    return std::max(limit, diff_t(MIN_CHUNK));
+  }
+
+  // The workspace and script of the smallest chunk.
+  static uint64_t minMemory() {
+    return uint64_t(MIN_CHUNK) * BYTES_PER_ELEMENT;
+  }
+
+  diff_t diff(RIter first1, RIter last1, RIter first2, RIter last2,
+              const sink_t& sink) {
+    sink_ = &sink;
+    pendingOp_ = ES_RETAIN;
+    pendingCount_ = 0;
+    lcs_ = 0;
+    diff_t prefix = 0;
+    for (; first1 != last1 && first2 != last2 && equalTo_(*first1, *first2);
+         ++first1, ++first2) {
+      prefix += 1;
+    }
+    diff_t suffix = 0;
+    for (; first1 != last1 && first2 != last2 &&
+           equalTo_(*(last1 - 1), *(last2 - 1));
+         --last1, --last2) {
+      suffix += 1;
+    }
+    emit(ES_RETAIN, prefix);
+    diffChunked(first1, last1, first2, last2);
+    emit(ES_RETAIN, suffix);
+    flush();
+    return lcs_;
+  }
+
+ private:
+  void diffChunked(RIter first1, RIter last1, RIter first2, RIter last2) {
+    for (;;) {
+      diff_t N = last1 - first1;
+      diff_t M = last2 - first2;
+      if (N + M <= maxChunk_) {
+        diffChunk(first1, N, first2, M);
+        return;
+      }
+      // Aim a little below the limit: the anchor search may stretch the
+      // destination side of the chunk by up to a quarter.
+      diff_t target = maxChunk_ * 4 / 5;
+      diff_t n = static_cast<diff_t>(double(target) * N / (N + M));
+      diff_t m = target - n;
+      n = std::min(std::max(n, diff_t(1)), N);
+      m = std::min(m, M);
+      RIter cut1 = first1 + n;
+      RIter cut2 = first2 + m;
+      findAnchor(cut1, last1, first2, cut2, last2, m / 4);
+      diffChunk(first1, cut1 - first1, first2, cut2 - first2);
+      first1 = cut1;
+      first2 = cut2;
+    }
+  }
+
+  // Moves (cut1, cut2) onto a pair of equal lines so the chunks meet on a
+  // retained line, searching `window` lines around cut2 for each of a few
+  // lines starting at cut1. Leaves the cuts alone when nothing matches.
+  void findAnchor(RIter& cut1, RIter last1, RIter first2, RIter& cut2,
+                  RIter last2, const diff_t window) {
+    for (diff_t probe = 0; probe < ANCHOR_PROBES && cut1 + probe < last1;
+         ++probe) {
+      RIter low = cut2 - std::min(window, diff_t(cut2 - first2));
+      RIter high = cut2 + std::min(window, diff_t(last2 - cut2));
+      for (RIter iter = low; iter != high; ++iter) {
+        if (equalTo_(*(cut1 + probe), *iter)) {
+          cut1 += probe;
+          cut2 = iter;
+          return;
+        }
+      }
+    }
+  }
+
+  void diffChunk(RIter first1, const diff_t N, RIter first2, const diff_t M) {
+    ses_.clear();
+    shortestEditScript(first1, 0, N, first2, 0, M, ses_, equalTo_);
+    for (const auto& p : ses_) {
+      emit(p.first, 1);
+    }
+  }
+
+  void emit(const EDIT_SCRIPT op, const uint64_t count) {
+    if (count == 0) {
+      return;
+    }
+    if (op == ES_RETAIN) {
+      lcs_ += count;
+    }
+    if (op != pendingOp_) {
+      flush();
+      pendingOp_ = op;
+    }
+    pendingCount_ += count;
+  }
+
+  void flush() {
+    if (pendingCount_ != 0) {
+      (*sink_)(pendingOp_, pendingCount_);
+    }
+    pendingCount_ = 0;
+  }
+
+ private:
+  diff_t maxChunk_;
+  const EqualTo& equalTo_;
+  const sink_t* sink_;
+  script_t ses_;
+  EDIT_SCRIPT pendingOp_;
+  uint64_t pendingCount_;
+  diff_t lcs_;
+};
+
+// Runs of the diff of [first1, last1) and [first2, last2) computed within
+// `maxMemory` bytes of workspace and script, returning the number of
+// retained lines.
+template <typename RIter, typename EqualTo>
+iter_dif_t<RIter> boundedEditScript(RIter first1, RIter last1, RIter first2,
+                                    RIter last2, const uint64_t maxMemory,
+                                    edit_runs_t& runs, const EqualTo& equalTo) {
+  edit_runs_t runsTemp;
+  BoundedDiff<RIter, EqualTo> bounded(maxMemory, equalTo);
+  iter_dif_t<RIter> lcs = bounded.diff(
+      first1, last1, first2, last2,
+      [&runsTemp](EDIT_SCRIPT op, uint64_t count) {
+        runsTemp.push_back(EditRun{op, count});
+      });
+  runs.swap(runsTemp);
+  return lcs;
+}
+
+template <typename RIter>
+iter_dif_t<RIter> boundedEditScript(RIter first1, RIter last1, RIter first2,
+                                    RIter last2, const uint64_t maxMemory,
+                                    edit_runs_t& runs) {
+  return boundedEditScript(
+      first1, last1, first2, last2, maxMemory, runs,
+      std::equal_to<typename std::iterator_traits<RIter>::value_type>());
+}
+
+}  // namespace mydiff
+
+#endif
@@ -0,0 +1,270 @@
+#ifndef _MYDIFF_DIFF_CACHE_H_
+#define _MYDIFF_DIFF_CACHE_H_
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "edit-runs.h"
+#include "mapped-file.h"
+#include "sha256.h"
+
+namespace mydiff {
+
+// Content-addressed store of compact edit scripts, shared by every process
+// pointed at the same directory.
+//
+// An entry is one file named after the hex key. Its layout is a fixed header
+// followed by an array of fixed-size run records, so a hit is served straight
+// from an mmap of the file. Entries are written to a private temporary file
+// and published with rename(2), therefore readers only ever observe complete
+// entries and concurrent writers of the same key simply replace each other.
+// A hit refreshes the entry's mtime. Stores keep a running estimate of the
+// directory size, rescanned on the first store, every EVICT_INTERVAL stores
+// for the entries of other processes, and whenever the estimate passes the
+// bound; the rescan then unlinks the least recently used entries down to
+// nine tenths of the bound. One instance may serve several threads.
+class DiffCache {
+  struct EntryHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t runCount;
+    int64_t lcs;
+  };
+
+  struct EntryRecord {
+    uint64_t op;
+    uint64_t count;
+  };
+
+  enum { ENTRY_VERSION = 2, EVICT_INTERVAL = 256 };
+
+ public:
+  DiffCache(const std::string& dir, const uint64_t maxBytes)
+      : dir_(dir), maxBytes_(maxBytes), estimate_(0), sinceScan_(0),
+        scanned_(false) {}
+
+  bool open() {
+    if (mkdir(dir_.c_str(), 0777) != 0 && errno != EEXIST) {
+      return errorLog("can not create " + dir_);
+    }
+    return true;
+  }
+
+  static std::string makeKey(const std::string& srcDigest,
+                             const std::string& dstDigest,
+                             const std::string& engine,
+                             const std::string& options) {
+    Sha256 sha;
+    sha.update(srcDigest).update("", 1).update(dstDigest).update("", 1);
+    sha.update(engine).update("", 1).update(options);
+    return sha.hexDigest();
+  }
+
+  // A hit whose runs do not consume exactly `srcLines` and `dstLines`, as
+  // a truncated or tampered entry might not, is a miss.
+  bool lookup(const std::string& key, const uint64_t srcLines,
+              const uint64_t dstLines, edit_runs_t& runs, int64_t& lcs) {
+    std::string path = entryPath(key);
+    MappedFile mapped;
+    if (!mapped.open(path) || mapped.size() < sizeof(EntryHeader)) {
+      return false;
+    }
+    EntryHeader header;
+    std::memcpy(&header, mapped.data(), sizeof(header));
+    // Divide rather than multiply, which a huge runCount would overflow.
+    size_t recordBytes = mapped.size() - sizeof(EntryHeader);
+    if (std::memcmp(header.magic, "MYDC", 4) != 0 ||
+        header.version != ENTRY_VERSION ||
+        recordBytes % sizeof(EntryRecord) != 0 ||
+        header.runCount != recordBytes / sizeof(EntryRecord)) {
+      return false;
+    }
+    const EntryRecord* records = reinterpret_cast<const EntryRecord*>(
+        mapped.data() + sizeof(EntryHeader));
+    edit_runs_t runsTemp;
+    runsTemp.reserve(header.runCount);
+    uint64_t srcLeft = srcLines, dstLeft = dstLines;
+    for (uint64_t i = 0; i != header.runCount; ++i) {
+      uint64_t count = records[i].count;
+      bool fits;
+      switch (records[i].op) {
+        case ES_RETAIN:
+          fits = count <= srcLeft && count <= dstLeft;
+          srcLeft -= fits ? count : 0;
+          dstLeft -= fits ? count : 0;
+          break;
+        case ES_DELETE:
+          fits = count <= srcLeft;
+          srcLeft -= fits ? count : 0;
+          break;
+        case ES_INSERT:
+          fits = count <= dstLeft;
+          dstLeft -= fits ? count : 0;
+          break;
+        default:
+          fits = false;
+      }
+      if (!fits) {
+        return false;
+      }
+      runsTemp.push_back(
+          EditRun{static_cast<EDIT_SCRIPT>(records[i].op), records[i].count});
+    }
+    if (srcLeft != 0 || dstLeft != 0) {
+      return false;
+    }
+    utimensat(AT_FDCWD, path.c_str(), nullptr, 0);
+    runs.swap(runsTemp);
+    lcs = header.lcs;
+    return true;
+  }
+
+  bool store(const std::string& key, const edit_runs_t& runs,
+             const int64_t lcs) {
+    std::string tmpPath = tempPath();
+    int fd = ::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0666);
+    if (fd < 0) {
+      return errorLog("can not create " + tmpPath);
+    }
+    EntryHeader header;
+    std::memcpy(header.magic, "MYDC", 4);
+    header.version = ENTRY_VERSION;
+    header.runCount = runs.size();
+    header.lcs = lcs;
+    std::vector<EntryRecord> records;
+    records.reserve(runs.size());
+    for (const auto& run : runs) {
+      records.push_back(EntryRecord{static_cast<uint64_t>(run.op), run.count});
+    }
+    bool ok =
+        writeAll(fd, &header, sizeof(header)) &&
+        writeAll(fd, records.data(), records.size() * sizeof(EntryRecord));
+    ok = (::close(fd) == 0) && ok;
+    if (!ok || rename(tmpPath.c_str(), entryPath(key).c_str()) != 0) {
+      unlink(tmpPath.c_str());
+      return errorLog("can not write entry " + key);
+    }
+    std::lock_guard<std::mutex> lock(evictMutex_);
+    estimate_ += sizeof(header) + records.size() * sizeof(EntryRecord);
+    if (!scanned_ || estimate_ > maxBytes_ || ++sinceScan_ == EVICT_INTERVAL) {
+      evict();
+    }
+    return true;
+  }
+
+ private:
+  struct EntryStat {
+    std::string path;
+    uint64_t size;
+    struct timespec mtime;
+  };
+
+  // Rescans the directory; called with evictMutex_ held.
+  void evict() {
+    DIR* dir = opendir(dir_.c_str());
+    if (dir == nullptr) {
+      return;
+    }
+    std::vector<EntryStat> entries;
+    uint64_t total = 0;
+    struct stat st;
+    time_t now = time(nullptr);
+    for (struct dirent* ent; (ent = readdir(dir)) != nullptr;) {
+      std::string name(ent->d_name);
+      if (name == "." || name == "..") {
+        continue;
+      }
+      std::string path = dir_ + "/" + name;
+      if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+        continue;
+      }
+      if (name.compare(0, 5, ".tmp.") == 0) {
+        // Left behind by a writer that died before its rename.
+        if (now - st.st_mtime > 3600) {
+          unlink(path.c_str());
+        }
+        continue;
+      }
+      entries.push_back(EntryStat{path, static_cast<uint64_t>(st.st_size),
+                                  st.st_mtim});
+      total += st.st_size;
+    }
+    closedir(dir);
+    scanned_ = true;
+    sinceScan_ = 0;
+    estimate_ = total;
+    if (total <= maxBytes_) {
+      return;
+    }
+    uint64_t target = maxBytes_ - maxBytes_ / 10;
+    std::sort(entries.begin(), entries.end(),
+              [](const EntryStat& left, const EntryStat& right) {
+                return left.mtime.tv_sec != right.mtime.tv_sec
+                           ? left.mtime.tv_sec < right.mtime.tv_sec
+                           : left.mtime.tv_nsec < right.mtime.tv_nsec;
+              });
+    for (const auto& entry : entries) {
+      if (total <= target) {
+        break;
+      }
+      // Another process may have evicted it first; either way it is gone.
+      unlink(entry.path.c_str());
+      total -= entry.size;
+    }
+    estimate_ = total;
+  }
+
+  std::string entryPath(const std::string& key) const {
+    return dir_ + "/" + key + ".ses";
+  }
+
+  std::string tempPath() const {
+    static std::atomic<unsigned> counter(0);
+    return dir_ + "/.tmp." + std::to_string(getpid()) + "." +
+           std::to_string(counter++);
+  }
+
+  static bool writeAll(int fd, const void* data, size_t size) {
+    const char* bytes = static_cast<const char*>(data);
+    for (; size != 0;) {
+      ssize_t n = write(fd, bytes, size);
+      if (n < 0) {
+        if (errno == EINTR) continue;
+        return false;
+      }
+      bytes += n;
+      size -= n;
+    }
+    return true;
+  }
+
+  bool errorLog(const std::string& logInfo) const {
+    std::cerr << "mydiff: cache: " << logInfo << std::endl;
+    return false;
+  }
+
+ private:
+  std::string dir_;
+  uint64_t maxBytes_;
+  std::mutex evictMutex_;
+  uint64_t estimate_;
+  unsigned sinceScan_;
+  bool scanned_;
+};
+
+}  // namespace mydiff
+
+#endif
@@ -0,0 +1,159 @@
+#ifndef _MYDIFF_EDIT_DISTANCE_H_
+#define _MYDIFF_EDIT_DISTANCE_H_
+
+#include <algorithm>
+#include <cstdlib>
+#include <functional>
+#include <iterator>
+#include <vector>
+
+#include "myers-diff.h"
+
+namespace mydiff {
+
+// Length D of the shortest edit script, the number of deletes plus inserts,
+// without the script. It runs only the forward and reverse greedy searches
+// of the Myers engine from both ends of the whole problem and stops where
+// they first overlap, so no middle snake is ever recursed into. The common
+// prefix and suffix are peeled off first. The V arrays grow with the search
+// and only cover diagonals -d..d, so the working memory is O(D) rather than
+// O(N + M); the time is O((N + M) D) as in the full diff.
+//
+// The bounded form gives up as soon as the search proves D > limit, after
+// about limit / 2 rounds, which makes "are these within T edits" cheap for
+// inputs that are far apart.
+template <typename RIter,
+          typename EqualTo =
+              std::equal_to<typename std::iterator_traits<RIter>::value_type>>
+class EditDistance {
+  typedef iter_dif_t<RIter> diff_t;
+
+  // Furthest reaching x per diagonal k, for k of either sign.
+  class Diagonals {
+   public:
+    void reset() {
+      positive_.assign(2, 0);
+      negative_.clear();
+    }
+
+    // Makes diagonals -d..d + 1 addressable.
+    void grow(const diff_t d) {
+      if (static_cast<diff_t>(positive_.size()) < d + 2) {
+        positive_.resize(d + 2, 0);
+      }
+      if (static_cast<diff_t>(negative_.size()) < d) {
+        negative_.resize(d, 0);
+      }
+    }
+
+    diff_t& operator[](const diff_t k) {
+      return k >= 0 ? positive_[k] : negative_[-k - 1];
+    }
+
+   private:
+    std::vector<diff_t> positive_;
+    std::vector<diff_t> negative_;
+  };
+
+ public:
+  explicit EditDistance(const EqualTo& equalTo = EqualTo())
+      : equalTo_(equalTo) {}
+
+  diff_t distance(RIter first1, RIter last1, RIter first2, RIter last2) {
+    return search(first1, last1, first2, last2, -1);
+  }
+
+  // D when it is at most `limit`, otherwise limit + 1.
+  diff_t distanceWithin(RIter first1, RIter last1, RIter first2, RIter last2,
+                        const diff_t limit) {
+    return search(first1, last1, first2, last2, limit);
+  }
+
+ private:
+  // A negative `limit` searches to the end.
+  diff_t search(RIter first1, RIter last1, RIter first2, RIter last2,
+                const diff_t limit) {
+    for (; first1 != last1 && first2 != last2 && equalTo_(*first1, *first2);
+         ++first1, ++first2) {
+    }
+    for (; first1 != last1 && first2 != last2 &&
+           equalTo_(*(last1 - 1), *(last2 - 1));
+         --last1, --last2) {
+    }
+    const diff_t N = last1 - first1;
+    const diff_t M = last2 - first2;
+    const diff_t delta = N - M;
+    const bool odd = (delta & 1) != 0;
+    if (limit >= 0 && std::abs(delta) > limit) {
+      return limit + 1;
+    }
+    if (N == 0 || M == 0) {
+      return N + M;
+    }
+    forward_.reset();
+    reverse_.reset();
+    for (diff_t d = 0; d <= (N + M + 1) / 2; ++d) {
+      forward_.grow(d);
+      reverse_.grow(d);
+      for (diff_t k = -d; k <= d; k += 2) {
+        diff_t x = k == -d || (k != d && forward_[k - 1] < forward_[k + 1])
+                       ? forward_[k + 1]
+                       : forward_[k - 1] + 1;
+        diff_t y = x - k;
+        for (; x < N && y < M && equalTo_(first1[x], first2[y]); ++x, ++y) {
+        }
+        forward_[k] = x;
+        if (odd && delta - k >= -(d - 1) && delta - k <= d - 1 &&
+            x >= N - reverse_[delta - k]) {
+          return 2 * d - 1;
+        }
+      }
+      for (diff_t k = -d; k <= d; k += 2) {
+        diff_t x = k == -d || (k != d && reverse_[k - 1] < reverse_[k + 1])
+                       ? reverse_[k + 1]
+                       : reverse_[k - 1] + 1;
+        diff_t y = x - k;
+        for (; x < N && y < M &&
+               equalTo_(first1[N - 1 - x], first2[M - 1 - y]);
+             ++x, ++y) {
+        }
+        reverse_[k] = x;
+        if (!odd && delta - k >= -d && delta - k <= d &&
+            forward_[delta - k] >= N - x) {
+          return 2 * d;
+        }
+      }
+      // No overlap after round d leaves D >= 2 * d + 1.
+      if (limit >= 0 && 2 * d + 1 > limit) {
+        return limit + 1;
+      }
+    }
+    return N + M;
+  }
+
+ private:
+  EqualTo equalTo_;
+  Diagonals forward_;
+  Diagonals reverse_;
+};
+
+// D of [first1, last1) and [first2, last2).
+template <typename RIter>
+iter_dif_t<RIter> editDistance(RIter first1, RIter last1, RIter first2,
+                               RIter last2) {
+  return EditDistance<RIter>().distance(first1, last1, first2, last2);
+}
+
+// D of [first1, last1) and [first2, last2) if it is at most `limit`,
+// otherwise limit + 1.
+template <typename RIter>
+iter_dif_t<RIter> editDistanceWithin(RIter first1, RIter last1, RIter first2,
+                                     RIter last2,
+                                     const iter_dif_t<RIter> limit) {
+  return EditDistance<RIter>().distanceWithin(first1, last1, first2, last2,
+                                              limit);
+}
+
+}  // namespace mydiff
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef _MYDIFF_EDIT_RUNS_H_
+#define _MYDIFF_EDIT_RUNS_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "myers-diff.h"
+
+namespace mydiff {
+
+// A compact SES: consecutive entries with the same edit collapsed into one
+// run. Delete runs consume source lines, insert runs consume destination
+// lines and retain runs consume both, strictly in order, so the indices of
+// the full SES can always be recovered from the run lengths alone.
+struct EditRun {
+  EDIT_SCRIPT op;
+  uint64_t count;
+};
+
+typedef std::vector<EditRun> edit_runs_t;
+
+template <typename Ses>
+void compactSes(const Ses& ses, edit_runs_t& runs) {
+  edit_runs_t runsTemp;
+  for (const auto& p : ses) {
+    if (!runsTemp.empty() && runsTemp.back().op == p.first) {
+      runsTemp.back().count += 1;
+    } else {
+      runsTemp.push_back(EditRun{p.first, 1});
+    }
+  }
+  runs.swap(runsTemp);
+}
+
+template <typename Ses>
+void expandRuns(const EditRun* first, const EditRun* last, Ses& ses) {
+  typedef typename Ses::value_type::second_type diff_t;
+  Ses sesTemp;
+  diff_t srcIndex = 0, dstIndex = 0;
+  for (; first != last; ++first) {
+    for (uint64_t i = 0; i != first->count; ++i) {
+      switch (first->op) {
+        case ES_RETAIN:
+          sesTemp.emplace_back(ES_RETAIN, srcIndex++);
+          dstIndex += 1;
+          break;
+        case ES_DELETE:
+          sesTemp.emplace_back(ES_DELETE, srcIndex++);
+          break;
+        case ES_INSERT:
+          sesTemp.emplace_back(ES_INSERT, dstIndex++);
+          break;
+        default:;
+      }
+    }
+  }
+  ses.swap(sesTemp);
+}
+
+template <typename Ses>
+void expandRuns(const edit_runs_t& runs, Ses& ses) {
+  expandRuns(runs.data(), runs.data() + runs.size(), ses);
+}
+
+}  // namespace mydiff
+
+#endif
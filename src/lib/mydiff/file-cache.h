@@ -0,0 +1,239 @@
+#ifndef _MYDIFF_FILE_CACHE_H_
+#define _MYDIFF_FILE_CACHE_H_
+
+#include <sys/stat.h>
+
+#include <cstdint>
+#include <iterator>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "binary-patch.h"
+#include "diff-cache.h"
+#include "line-interner.h"
+#include "line-loader.h"
+
+namespace mydiff {
+
+// A file loaded and split into interned lines. The interner is held by the
+// file, so its lines stay valid for as long as anyone uses the file.
+struct CachedFile {
+  std::string path;
+  std::string digest;
+  line_vector_t lines;
+  bool noFinalNewline;
+  uint64_t bytes;
+  std::shared_ptr<LineInterner> interner;
+  dev_t device;
+  ino_t inode;
+  off_t size;
+  struct timespec mtime;
+};
+
+// In-memory LRU of loaded files for a long-running process, keyed by path
+// and also reachable by SHA-256 of the contents. An entry is reused while the
+// file's device, inode, size and mtime are unchanged.
+//
+// Interned lines are never freed one by one, so the interner is replaced by
+// a fresh generation once it holds many more lines than the cache still
+// references. Entries of an older generation are re-interned into the
+// current one on their next use; two files returned by a single get() call
+// always share an interner and compare by pointer.
+class FileCache {
+  enum { MIN_GENERATION_LINES = 1 << 20, GENERATION_SLACK = 4 };
+
+ public:
+  typedef std::shared_ptr<const CachedFile> file_ptr;
+
+  explicit FileCache(const uint64_t maxBytes)
+      : maxBytes_(maxBytes),
+        bytes_(0),
+        lines_(0),
+        interner_(std::make_shared<LineInterner>()) {}
+
+  FileCache(const FileCache&) = delete;
+
+  FileCache& operator=(const FileCache&) = delete;
+
+  // Resolves `ref`, a path or "sha256:<hex>" of a file already cached.
+  file_ptr get(const std::string& ref) {
+    static const std::string prefix("sha256:");
+    if (ref.compare(0, prefix.size(), prefix) == 0) {
+      return getByDigest(ref.substr(prefix.size()));
+    }
+    return getByPath(ref);
+  }
+
+  // Resolves both references into files that share an interner.
+  bool get(const std::string& ref1, const std::string& ref2, file_ptr& file1,
+           file_ptr& file2) {
+    for (;;) {
+      file1 = get(ref1);
+      file2 = get(ref2);
+      if (file1 == nullptr || file2 == nullptr) {
+        return false;
+      }
+      if (file1->interner == file2->interner) {
+        return true;
+      }
+    }
+  }
+
+  size_t files() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return lru_.size();
+  }
+
+  uint64_t bytes() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return bytes_;
+  }
+
+  size_t internedLines() const {
+    std::shared_ptr<LineInterner> interner = currentInterner();
+    return interner->size();
+  }
+
+ private:
+  typedef std::list<file_ptr> lru_t;
+
+  file_ptr getByPath(const std::string& path) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+      return errorLog("cannot stat " + path);
+    }
+    file_ptr stale;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto found = byPath_.find(path);
+      if (found != byPath_.end()) {
+        const CachedFile& file = **found->second;
+        if (file.device == st.st_dev && file.inode == st.st_ino &&
+            file.size == st.st_size &&
+            file.mtime.tv_sec == st.st_mtim.tv_sec &&
+            file.mtime.tv_nsec == st.st_mtim.tv_nsec) {
+          stale = touch(found->second);
+          if (stale->interner == interner_) {
+            return stale;
+          }
+        }
+      }
+    }
+    if (stale != nullptr) {
+      return insert(reintern(*stale));
+    }
+    auto file = std::make_shared<CachedFile>();
+    file->path = path;
+    file->device = st.st_dev;
+    file->inode = st.st_ino;
+    file->size = st.st_size;
+    file->mtime = st.st_mtim;
+    file->interner = currentInterner();
+    // The digest of the bytes loaded, not of the file on disk, which may
+    // have changed since.
+    if (!LineLoader(*file->interner).load(path, file->lines, &file->digest)) {
+      return errorLog("cannot load " + path);
+    }
+    file->noFinalNewline = BinaryPatch::lacksFinalNewline(path);
+    file->bytes = st.st_size + file->lines.size() * sizeof(const Line*);
+    return insert(file);
+  }
+
+  file_ptr getByDigest(const std::string& digest) {
+    file_ptr stale;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto found = byDigest_.find(digest);
+      if (found == byDigest_.end()) {
+        return errorLog("no cached file with digest " + digest);
+      }
+      file_ptr file = touch(found->second);
+      if (file->interner == interner_) {
+        return file;
+      }
+      stale = file;
+    }
+    return insert(reintern(*stale));
+  }
+
+  // Copies `stale` with its lines moved into the current interner.
+  std::shared_ptr<CachedFile> reintern(const CachedFile& stale) {
+    auto file = std::make_shared<CachedFile>(stale);
+    file->interner = currentInterner();
+    for (auto& line : file->lines) {
+      line = file->interner->intern(line->data, line->size, line->hash);
+    }
+    return file;
+  }
+
+  // Publishes `file`, replacing any entry for the same path, then evicts
+  // from the cold end and starts a new interner generation when the
+  // current one has grown well beyond what the cache still uses.
+  file_ptr insert(const std::shared_ptr<CachedFile>& file) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto old = byPath_.find(file->path);
+    if (old != byPath_.end()) {
+      erase(old->second);
+    }
+    lru_.push_front(file);
+    byPath_[file->path] = lru_.begin();
+    byDigest_[file->digest] = lru_.begin();
+    bytes_ += file->bytes;
+    lines_ += file->lines.size();
+    while (bytes_ > maxBytes_ && lru_.size() > 1) {
+      erase(std::prev(lru_.end()));
+    }
+    if (interner_->size() >
+        GENERATION_SLACK * lines_ + MIN_GENERATION_LINES) {
+      interner_ = std::make_shared<LineInterner>();
+    }
+    return file;
+  }
+
+  void erase(lru_t::iterator iter) {
+    const CachedFile& file = **iter;
+    auto byPath = byPath_.find(file.path);
+    if (byPath != byPath_.end() && byPath->second == iter) {
+      byPath_.erase(byPath);
+    }
+    auto byDigest = byDigest_.find(file.digest);
+    if (byDigest != byDigest_.end() && byDigest->second == iter) {
+      byDigest_.erase(byDigest);
+    }
+    bytes_ -= file.bytes;
+    lines_ -= file.lines.size();
+    lru_.erase(iter);
+  }
+
+  file_ptr touch(lru_t::iterator iter) {
+    lru_.splice(lru_.begin(), lru_, iter);
+    return *iter;
+  }
+
+  std::shared_ptr<LineInterner> currentInterner() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return interner_;
+  }
+
+  static file_ptr errorLog(const std::string& logInfo) {
+    std::cerr << "mydiff: file cache: " << logInfo << std::endl;
+    return nullptr;
+  }
+
+ private:
+  uint64_t maxBytes_;
+  uint64_t bytes_;
+  uint64_t lines_;
+  std::shared_ptr<LineInterner> interner_;
+  lru_t lru_;
+  std::unordered_map<std::string, lru_t::iterator> byPath_;
+  std::unordered_map<std::string, lru_t::iterator> byDigest_;
+  mutable std::mutex mutex_;
+};
+
+}  // namespace mydiff
+
+#endif
@@ -0,0 +1,155 @@
+#ifndef _MYDIFF_LINE_INTERNER_H_
+#define _MYDIFF_LINE_INTERNER_H_
+
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace mydiff {
+
+// An interned line. Every distinct content is stored once, so two lines are
+// equal exactly when their `const Line*` handles are, and a file can be
+// diffed as a vector of pointers with the default std::equal_to.
+struct Line {
+  const char* data;
+  size_t size;
+  uint64_t hash;
+};
+
+inline uint64_t hashBytes(const char* data, size_t size) {
+  const uint64_t mul = 0x9ddfea08eb382d69ULL;
+  uint64_t h = 0xcbf29ce484222325ULL ^ (size * mul);
+  uint64_t word;
+  for (; size >= 8; size -= 8, data += 8) {
+    std::memcpy(&word, data, 8);
+    h = (h ^ (word * mul)) * mul;
+    h ^= h >> 47;
+  }
+  if (size != 0) {
+    word = 0;
+    std::memcpy(&word, data, size);
+    h = (h ^ (word * mul)) * mul;
+  }
+  h ^= h >> 29;
+  h *= mul;
+  return h ^ (h >> 32);
+}
+
+// Thread-safe line table. Lines are spread over independently locked shards
+// by hash so that concurrent loaders rarely contend. Each shard is an open
+// addressing table of (hash, Line*) slots; the Line records live in a deque
+// and the bytes of each new line are copied into chunked storage, so neither
+// ever moves once interned.
+class LineInterner {
+  enum { SHARD_BITS = 6, SHARD_COUNT = 1 << SHARD_BITS };
+  enum { CHUNK_SIZE = 1 << 20, MIN_SLOTS = 64 };
+
+  struct Slot {
+    uint64_t hash;
+    const Line* line;
+  };
+
+  struct Shard {
+    Shard() : slots(MIN_SLOTS, Slot{0, nullptr}), chunkUsed(CHUNK_SIZE) {}
+
+    std::mutex mutex;
+    std::vector<Slot> slots;
+    std::deque<Line> lines;
+    std::vector<std::unique_ptr<char[]>> chunks;
+    std::vector<std::unique_ptr<char[]>> largeLines;
+    size_t chunkUsed;
+  };
+
+ public:
+  LineInterner() : shards_(new Shard[SHARD_COUNT]) {}
+
+  LineInterner(const LineInterner&) = delete;
+
+  LineInterner& operator=(const LineInterner&) = delete;
+
+  const Line* intern(const char* data, const size_t size) {
+    return intern(data, size, hashBytes(data, size));
+  }
+
+  const Line* intern(const char* data, const size_t size,
+                     const uint64_t hash) {
+    Shard& shard = shards_[hash & (SHARD_COUNT - 1)];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    size_t mask = shard.slots.size() - 1;
+    size_t pos = (hash >> SHARD_BITS) & mask;
+    for (;; pos = (pos + 1) & mask) {
+      const Slot& slot = shard.slots[pos];
+      if (slot.line == nullptr) {
+        break;
+      }
+      if (slot.hash == hash && slot.line->size == size &&
+          std::memcmp(slot.line->data, data, size) == 0) {
+        return slot.line;
+      }
+    }
+    shard.lines.push_back(Line{copyBytes(shard, data, size), size, hash});
+    const Line* line = &shard.lines.back();
+    shard.slots[pos] = Slot{hash, line};
+    if (shard.lines.size() * 2 > shard.slots.size()) {
+      grow(shard);
+    }
+    return line;
+  }
+
+  size_t size() const {
+    size_t count = 0;
+    for (size_t i = 0; i != SHARD_COUNT; ++i) {
+      std::lock_guard<std::mutex> lock(shards_[i].mutex);
+      count += shards_[i].lines.size();
+    }
+    return count;
+  }
+
+ private:
+  static void grow(Shard& shard) {
+    std::vector<Slot> slots(shard.slots.size() * 2, Slot{0, nullptr});
+    size_t mask = slots.size() - 1;
+    for (const auto& slot : shard.slots) {
+      if (slot.line == nullptr) {
+        continue;
+      }
+      size_t pos = (slot.hash >> SHARD_BITS) & mask;
+      for (; slots[pos].line != nullptr; pos = (pos + 1) & mask) {
+      }
+      slots[pos] = slot;
+    }
+    shard.slots.swap(slots);
+  }
+
+  static const char* copyBytes(Shard& shard, const char* data,
+                               const size_t size) {
+    if (size == 0) {
+      return "";
+    }
+    if (size > CHUNK_SIZE / 4) {
+      shard.largeLines.emplace_back(new char[size]);
+      std::memcpy(shard.largeLines.back().get(), data, size);
+      return shard.largeLines.back().get();
+    }
+    if (CHUNK_SIZE - shard.chunkUsed < size) {
+      shard.chunks.emplace_back(new char[CHUNK_SIZE]);
+      shard.chunkUsed = 0;
+    }
+    char* dst = shard.chunks.back().get() + shard.chunkUsed;
+    std::memcpy(dst, data, size);
+    shard.chunkUsed += size;
+    return dst;
+  }
+
+ private:
+  std::unique_ptr<Shard[]> shards_;
+};
+
+typedef std::vector<const Line*> line_vector_t;
+
+}  // namespace mydiff
+
+#endif
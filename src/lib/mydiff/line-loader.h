@@ -0,0 +1,264 @@
+#ifndef _MYDIFF_LINE_LOADER_H_
+#define _MYDIFF_LINE_LOADER_H_
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bounded-queue.h"
+#include "line-interner.h"
+#include "sha256.h"
+#include "trace.h"
+
+namespace mydiff {
+
+// Loads files into interned line vectors through a three stage pipeline per
+// file: a reader thread pulls large blocks from the file, a splitter thread
+// cuts them at newlines with memchr, and the calling thread hashes and
+// interns the lines. The stages are joined by bounded queues, so reading,
+// splitting and interning overlap while at most a few blocks are in flight.
+// Files that fit in one block skip the pipeline and load on the calling
+// thread, which is cheaper than starting the stages for them.
+// Lines follow std::getline: the newline is dropped and a trailing line
+// without one still counts. A caller may ask for the SHA-256 of the file
+// too, which the reader hashes block by block as it goes.
+class LineLoader {
+  enum { BLOCK_SIZE = 4 << 20, QUEUE_DEPTH = 4 };
+
+  struct Block {
+    std::unique_ptr<char[]> data;
+    size_t size;
+  };
+
+  struct Span {
+    const char* data;
+    size_t size;
+  };
+
+  struct LineBatch {
+    std::unique_ptr<Block> block;
+    std::vector<Span> lines;
+    // Lines that straddled a block boundary, reassembled by the splitter.
+    std::vector<std::unique_ptr<std::string>> joined;
+  };
+
+ public:
+  explicit LineLoader(LineInterner& interner) : interner_(interner) {}
+
+  template <typename Alloc>
+  bool load(const std::string& file, std::vector<const Line*, Alloc>& lines,
+            std::string* digest = nullptr) {
+    TraceScope trace("load");
+    int fd = ::open(file.c_str(), O_RDONLY);
+    if (fd < 0) {
+      std::cerr << "open error on " << file << std::endl;
+      return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size <= BLOCK_SIZE) {
+      trace.arg("bytes", st.st_size);
+      bool ok = loadSmall(fd, lines, digest);
+      trace.arg("lines", lines.size());
+      ::close(fd);
+      if (!ok) {
+        std::cerr << "read error on " << file << std::endl;
+      }
+      return ok;
+    }
+    trace.arg("bytes", st.st_size);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    BoundedQueue<std::unique_ptr<Block>> blocks(QUEUE_DEPTH);
+    BoundedQueue<std::unique_ptr<LineBatch>> batches(QUEUE_DEPTH);
+    bool readOk = true;
+    Sha256 sha;
+    std::thread reader([&] {
+      readOk = readBlocks(fd, blocks, digest != nullptr ? &sha : nullptr);
+      blocks.close();
+    });
+    std::thread splitter([&] {
+      splitLines(blocks, batches);
+      batches.close();
+    });
+    std::vector<const Line*, Alloc> linesTemp(lines.get_allocator());
+    internLines(batches, linesTemp);
+    reader.join();
+    splitter.join();
+    ::close(fd);
+    if (!readOk) {
+      std::cerr << "read error on " << file << std::endl;
+      return false;
+    }
+    trace.arg("lines", linesTemp.size());
+    lines.swap(linesTemp);
+    if (digest != nullptr) {
+      *digest = sha.hexDigest();
+    }
+    return true;
+  }
+
+  // Loads both inputs of a diff at once, each through its own pipeline. The
+  // two vectors are filled from different threads, so they must not share a
+  // MonotonicArena.
+  template <typename Alloc>
+  static bool load(LineInterner& interner, const std::string& srcFile,
+                   std::vector<const Line*, Alloc>& src,
+                   const std::string& dstFile,
+                   std::vector<const Line*, Alloc>& dst,
+                   std::string* srcDigest = nullptr,
+                   std::string* dstDigest = nullptr) {
+    if (fileSize(srcFile) <= BLOCK_SIZE && fileSize(dstFile) <= BLOCK_SIZE) {
+      return LineLoader(interner).load(srcFile, src, srcDigest) &&
+             LineLoader(interner).load(dstFile, dst, dstDigest);
+    }
+    bool srcOk = true;
+    std::thread srcLoader([&] {
+      srcOk = LineLoader(interner).load(srcFile, src, srcDigest);
+    });
+    bool dstOk = LineLoader(interner).load(dstFile, dst, dstDigest);
+    srcLoader.join();
+    return srcOk && dstOk;
+  }
+
+ private:
+  static off_t fileSize(const std::string& file) {
+    struct stat st;
+    return stat(file.c_str(), &st) == 0 ? st.st_size : 0;
+  }
+
+  template <typename Alloc>
+  bool loadSmall(int fd, std::vector<const Line*, Alloc>& lines,
+                 std::string* digest) {
+    std::string content;
+    {
+      TraceScope trace("read");
+      char buffer[64 << 10];
+      for (;;) {
+        ssize_t n = read(fd, buffer, sizeof(buffer));
+        if (n < 0) {
+          if (errno == EINTR) continue;
+          return false;
+        }
+        if (n == 0) break;
+        content.append(buffer, n);
+      }
+    }
+    if (digest != nullptr) {
+      *digest = Sha256().update(content).hexDigest();
+    }
+    // Splitting and interning are one loop here, traced as interning.
+    TraceScope trace("intern");
+    std::vector<const Line*, Alloc> linesTemp(lines.get_allocator());
+    const char* first = content.data();
+    const char* last = first + content.size();
+    for (; first != last;) {
+      const char* newline =
+          static_cast<const char*>(std::memchr(first, '\n', last - first));
+      const char* end = newline == nullptr ? last : newline;
+      linesTemp.push_back(interner_.intern(first, end - first));
+      first = newline == nullptr ? last : newline + 1;
+    }
+    lines.swap(linesTemp);
+    return true;
+  }
+
+  // Feeds each block to `sha` unless it is null.
+  static bool readBlocks(int fd, BoundedQueue<std::unique_ptr<Block>>& blocks,
+                         Sha256* sha) {
+    for (;;) {
+      std::unique_ptr<Block> block(
+          new Block{std::unique_ptr<char[]>(new char[BLOCK_SIZE]), 0});
+      TraceScope trace("read");
+      for (; block->size != BLOCK_SIZE;) {
+        ssize_t n = read(fd, block->data.get() + block->size,
+                         BLOCK_SIZE - block->size);
+        if (n < 0) {
+          if (errno == EINTR) continue;
+          return false;
+        }
+        if (n == 0) break;
+        block->size += n;
+      }
+      trace.arg("bytes", block->size);
+      if (sha != nullptr) {
+        sha->update(block->data.get(), block->size);
+      }
+      bool eof = block->size != BLOCK_SIZE;
+      if (block->size != 0 && !blocks.push(std::move(block))) {
+        return false;
+      }
+      if (eof) {
+        return true;
+      }
+    }
+  }
+
+  static void splitLines(BoundedQueue<std::unique_ptr<Block>>& blocks,
+                         BoundedQueue<std::unique_ptr<LineBatch>>& batches) {
+    std::string partial;
+    bool hasPartial = false;
+    for (std::unique_ptr<Block> block; blocks.pop(block);) {
+      TraceScope trace("split", "bytes", block->size);
+      std::unique_ptr<LineBatch> batch(new LineBatch);
+      const char* first = block->data.get();
+      const char* last = first + block->size;
+      for (;;) {
+        const char* newline = static_cast<const char*>(
+            std::memchr(first, '\n', last - first));
+        if (newline == nullptr) {
+          partial.append(first, last);
+          hasPartial = (first != last) || hasPartial;
+          break;
+        }
+        if (hasPartial) {
+          partial.append(first, newline);
+          batch->joined.emplace_back(new std::string());
+          batch->joined.back()->swap(partial);
+          batch->lines.push_back(Span{batch->joined.back()->data(),
+                                      batch->joined.back()->size()});
+          hasPartial = false;
+        } else {
+          batch->lines.push_back(Span{first, size_t(newline - first)});
+        }
+        first = newline + 1;
+      }
+      batch->block = std::move(block);
+      if (!batches.push(std::move(batch))) {
+        return;
+      }
+    }
+    if (hasPartial) {
+      std::unique_ptr<LineBatch> batch(new LineBatch);
+      batch->joined.emplace_back(new std::string());
+      batch->joined.back()->swap(partial);
+      batch->lines.push_back(
+          Span{batch->joined.back()->data(), batch->joined.back()->size()});
+      batches.push(std::move(batch));
+    }
+  }
+
+  template <typename Alloc>
+  void internLines(BoundedQueue<std::unique_ptr<LineBatch>>& batches,
+                   std::vector<const Line*, Alloc>& lines) {
+    for (std::unique_ptr<LineBatch> batch; batches.pop(batch);) {
+      TraceScope trace("intern", "lines", batch->lines.size());
+      for (const auto& span : batch->lines) {
+        lines.push_back(interner_.intern(span.data, span.size));
+      }
+    }
+  }
+
+ private:
+  LineInterner& interner_;
+};
+
+}  // namespace mydiff
+
+#endif
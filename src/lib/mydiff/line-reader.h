@@ -0,0 +1,139 @@
+#ifndef _MYDIFF_LINE_READER_H_
+#define _MYDIFF_LINE_READER_H_
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "sha256.h"
+
+namespace mydiff {
+
+// Sequential line reader over a file descriptor with a fixed-size buffer
+// that only grows to fit the longest line. Returned lines point into the
+// buffer and stay valid until the next call. Every byte read is also fed to
+// a SHA-256, so a single pass both splits and checksums the file.
+class LineReader {
+  enum { BUFFER_SIZE = 1 << 20 };
+
+ public:
+  LineReader() : fd_(-1), begin_(0), end_(0), eof_(false), error_(false) {}
+
+  ~LineReader() { close(); }
+
+  LineReader(const LineReader&) = delete;
+
+  LineReader& operator=(const LineReader&) = delete;
+
+  bool open(const std::string& file) {
+    close();
+    fd_ = ::open(file.c_str(), O_RDONLY);
+    if (fd_ < 0) {
+      return false;
+    }
+    posix_fadvise(fd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+    buffer_.resize(BUFFER_SIZE);
+    begin_ = end_ = 0;
+    eof_ = error_ = false;
+    sha_.reset();
+    return true;
+  }
+
+  void close() {
+    if (fd_ >= 0) {
+      ::close(fd_);
+    }
+    fd_ = -1;
+  }
+
+  bool next(const char*& data, size_t& size) {
+    for (size_t scanned = begin_;;) {
+      const char* first = buffer_.data() + scanned;
+      const char* newline = static_cast<const char*>(
+          std::memchr(first, '\n', end_ - scanned));
+      if (newline != nullptr) {
+        data = buffer_.data() + begin_;
+        size = newline - data;
+        begin_ = newline - buffer_.data() + 1;
+        return true;
+      }
+      if (eof_) {
+        if (begin_ == end_) {
+          return false;
+        }
+        data = buffer_.data() + begin_;
+        size = end_ - begin_;
+        begin_ = end_;
+        return true;
+      }
+      scanned = end_ - begin_;
+      if (!fill()) {
+        return false;
+      }
+    }
+  }
+
+  // Reads whatever is left so that digest() covers the whole file.
+  bool drain() {
+    for (; !eof_;) {
+      begin_ = end_ = 0;
+      if (!fill()) {
+        return false;
+      }
+    }
+    begin_ = end_;
+    return !error_;
+  }
+
+  bool atEnd() const { return eof_ && begin_ == end_; }
+
+  bool failed() const { return error_; }
+
+  void digest(unsigned char digest[Sha256::DIGEST_SIZE]) {
+    sha_.final(digest);
+  }
+
+ private:
+  bool fill() {
+    if (begin_ != 0) {
+      std::memmove(buffer_.data(), buffer_.data() + begin_, end_ - begin_);
+      end_ -= begin_;
+      begin_ = 0;
+    }
+    if (end_ == buffer_.size()) {
+      buffer_.resize(buffer_.size() * 2);
+    }
+    for (;;) {
+      ssize_t n = read(fd_, buffer_.data() + end_, buffer_.size() - end_);
+      if (n < 0) {
+        if (errno == EINTR) continue;
+        error_ = true;
+        return false;
+      }
+      if (n == 0) {
+        eof_ = true;
+      } else {
+        sha_.update(buffer_.data() + end_, n);
+        end_ += n;
+      }
+      return true;
+    }
+  }
+
+ private:
+  int fd_;
+  std::vector<char> buffer_;
+  size_t begin_;
+  size_t end_;
+  bool eof_;
+  bool error_;
+  Sha256 sha_;
+};
+
+}  // namespace mydiff
+
+#endif
@@ -0,0 +1,218 @@
+#ifndef _MYDIFF_LISP_DIFF_H_
+#define _MYDIFF_LISP_DIFF_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "../recursiveTree/recursive-map.h"
+#include "line-interner.h"
+#include "myers-diff.h"
+#include "trace.h"
+
+namespace mydiff {
+
+enum LISP_EDIT {
+  LE_ADDED,
+  LE_DELETED,
+  LE_REPLACED,
+  LE_VALUE_DELETED,
+  LE_VALUE_INSERTED
+};
+
+// One edit of a LispDiff, addressed by the keys leading to the node from
+// the root as `/key` per level, or `/` for the root. Within a key `\`, `/`,
+// tab and newline are written `\\`, `\/`, `\t` and `\n`, and an empty key
+// is `\e`, so that no two nodes share a path. A node whose kind differs
+// between the sides, a value list, a subtree or empty, is replaced as a
+// whole; value lists on both sides are diffed value by value, `index`
+// being the position of a deleted value in the source and of an inserted
+// one in the destination.
+struct LispEdit {
+  LISP_EDIT op;
+  std::string path;
+  const dblisp::RecTree* src;
+  const dblisp::RecTree* dst;
+  uint64_t index;
+};
+
+// Structural diff of two dblisp trees. Every node first gets a hash of its
+// content, its values or its children's keys and hashes, so any two
+// subtrees with equal hashes are taken as equal in O(1) and never entered.
+// Children of changed nodes are matched by key in one merge over both
+// sorted child lists, and value lists go through shortestEditScript().
+// Hashes are 64 bits, so two different subtrees compare equal only on a
+// collision.
+class LispDiff {
+  // Hash of a subtree and its number of nodes, stored in preorder so that
+  // the children of node i start at i + 1 and follow each other.
+  struct NodeHash {
+    uint64_t hash;
+    size_t size;
+  };
+
+  enum NODE_KIND { NK_EMPTY, NK_VALUES, NK_TREE };
+
+  struct ValueEqual {
+    bool operator()(const std::string* a, const std::string* b) const {
+      return *a == *b;
+    }
+  };
+
+ public:
+  void diff(const dblisp::RecTree& src, const dblisp::RecTree& dst,
+            std::vector<LispEdit>& edits) {
+    {
+      TraceScope trace("lisp hash");
+      srcHashes_.clear();
+      dstHashes_.clear();
+      hashTree(src, srcHashes_);
+      hashTree(dst, dstHashes_);
+    }
+    TraceScope trace("lisp diff");
+    std::vector<LispEdit> editsTemp;
+    std::string path;
+    diffNode(src, 0, dst, 0, path, editsTemp);
+    edits.swap(editsTemp);
+  }
+
+ private:
+  static NODE_KIND kindOf(const dblisp::RecTree& tree) {
+    return tree.isMap() ? NK_TREE : tree.isValue() ? NK_VALUES : NK_EMPTY;
+  }
+
+  static uint64_t mix(uint64_t h, const uint64_t x) {
+    const uint64_t mul = 0x9ddfea08eb382d69ULL;
+    h = (h ^ x) * mul;
+    return h ^ (h >> 47);
+  }
+
+  static uint64_t hashString(const std::string& str) {
+    return hashBytes(str.data(), str.size());
+  }
+
+  static uint64_t hashTree(const dblisp::RecTree& tree,
+                           std::vector<NodeHash>& hashes) {
+    size_t index = hashes.size();
+    hashes.push_back(NodeHash{0, 1});
+    NODE_KIND kind = kindOf(tree);
+    uint64_t h = mix(0, kind);
+    if (kind == NK_VALUES) {
+      for (size_t i = 0; i != tree.valueCount(); ++i) {
+        h = mix(h, hashString(tree.value(i).str()));
+      }
+    } else if (kind == NK_TREE) {
+      for (const auto& child : tree) {
+        h = mix(h, hashString(child.key().str()));
+        h = mix(h, hashTree(child, hashes));
+      }
+    }
+    hashes[index] = NodeHash{h, hashes.size() - index};
+    return h;
+  }
+
+  void diffNode(const dblisp::RecTree& src, size_t srcIndex,
+                const dblisp::RecTree& dst, size_t dstIndex, std::string& path,
+                std::vector<LispEdit>& edits) const {
+    if (srcHashes_[srcIndex].hash == dstHashes_[dstIndex].hash) {
+      return;
+    }
+    NODE_KIND kind = kindOf(src);
+    if (kind != kindOf(dst)) {
+      edits.push_back(LispEdit{LE_REPLACED, pathOf(path), &src, &dst, 0});
+      return;
+    }
+    if (kind == NK_VALUES) {
+      diffValues(src, dst, path, edits);
+      return;
+    }
+    if (kind != NK_TREE) {
+      return;
+    }
+    auto srcChild = src.begin(), dstChild = dst.begin();
+    srcIndex += 1;
+    dstIndex += 1;
+    size_t pathSize = path.size();
+    while (srcChild != src.end() || dstChild != dst.end()) {
+      bool srcOnly =
+          dstChild == dst.end() ||
+          (srcChild != src.end() && srcChild->key() < dstChild->key());
+      bool dstOnly = !srcOnly && (srcChild == src.end() ||
+                                  dstChild->key() < srcChild->key());
+      const dblisp::RecTree& child = srcOnly ? *srcChild : *dstChild;
+      appendKey(child.key().str(), path);
+      if (srcOnly) {
+        edits.push_back(LispEdit{LE_DELETED, path, &*srcChild, nullptr, 0});
+      } else if (dstOnly) {
+        edits.push_back(LispEdit{LE_ADDED, path, nullptr, &*dstChild, 0});
+      } else {
+        diffNode(*srcChild, srcIndex, *dstChild, dstIndex, path, edits);
+      }
+      path.resize(pathSize);
+      if (!dstOnly) {
+        srcIndex += srcHashes_[srcIndex].size;
+        ++srcChild;
+      }
+      if (!srcOnly) {
+        dstIndex += dstHashes_[dstIndex].size;
+        ++dstChild;
+      }
+    }
+  }
+
+  static void diffValues(const dblisp::RecTree& src,
+                         const dblisp::RecTree& dst, const std::string& path,
+                         std::vector<LispEdit>& edits) {
+    std::vector<const std::string*> srcValues, dstValues;
+    for (size_t i = 0; i != src.valueCount(); ++i) {
+      srcValues.push_back(&src.value(i).str());
+    }
+    for (size_t i = 0; i != dst.valueCount(); ++i) {
+      dstValues.push_back(&dst.value(i).str());
+    }
+    typedef std::vector<const std::string*>::const_iterator value_iter;
+    ses_t<value_iter> ses;
+    shortestEditScript(srcValues.cbegin(), srcValues.cend(), dstValues.cbegin(),
+                       dstValues.cend(), ses, ValueEqual());
+    for (const auto& edit : ses) {
+      if (edit.first == ES_DELETE) {
+        edits.push_back(LispEdit{LE_VALUE_DELETED, pathOf(path), &src, &dst,
+                                 static_cast<uint64_t>(edit.second)});
+      } else if (edit.first == ES_INSERT) {
+        edits.push_back(LispEdit{LE_VALUE_INSERTED, pathOf(path), &src, &dst,
+                                 static_cast<uint64_t>(edit.second)});
+      }
+    }
+  }
+
+  static void appendKey(const std::string& key, std::string& path) {
+    path.push_back('/');
+    if (key.empty()) {
+      path.append("\\e");
+    }
+    for (const char c : key) {
+      if (c == '\\' || c == '/') {
+        path.push_back('\\');
+        path.push_back(c);
+      } else if (c == '\t') {
+        path.append("\\t");
+      } else if (c == '\n') {
+        path.append("\\n");
+      } else {
+        path.push_back(c);
+      }
+    }
+  }
+
+  static std::string pathOf(const std::string& path) {
+    return path.empty() ? "/" : path;
+  }
+
+ private:
+  std::vector<NodeHash> srcHashes_;
+  std::vector<NodeHash> dstHashes_;
+};
+
+}  // namespace mydiff
+
+#endif
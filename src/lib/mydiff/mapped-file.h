@@ -0,0 +1,22 @@
+#ifndef _MYDIFF_MAPPED_FILE_H_
+#define _MYDIFF_MAPPED_FILE_H_
+
+#include <cstring>
+#include <string>
+
+#include "../common/mapped-file.h"
+
+namespace mydiff {
+
+using common::MappedFile;
+
+inline bool sameContents(const std::string& file1, const std::string& file2) {
+  MappedFile mapped1, mapped2;
+  return mapped1.open(file1) && mapped2.open(file2) &&
+         mapped1.size() == mapped2.size() &&
+         std::memcmp(mapped1.data(), mapped2.data(), mapped1.size()) == 0;
+}
+
+}  // namespace mydiff
+
+#endif
@@ -0,0 +1,128 @@
+#ifndef _MYDIFF_MOVE_DETECTOR_H_
+#define _MYDIFF_MOVE_DETECTOR_H_
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "edit-runs.h"
+#include "line-interner.h"
+
+namespace mydiff {
+
+// `count` deleted source lines starting at `srcIndex` that reappear as the
+// inserted destination lines starting at `dstIndex`. An exact block has
+// identical lines; the others only match once blanks are ignored.
+struct MovedBlock {
+  uint64_t srcIndex;
+  uint64_t dstIndex;
+  uint64_t count;
+  bool exact;
+};
+
+typedef std::vector<MovedBlock> moves_t;
+
+// Post-pass over the runs of a diff that pairs deleted blocks with inserted
+// blocks of the same content, in destination order. Deleted lines are
+// indexed by a whitespace-insensitive hash; each inserted line probes the
+// index and the longest block that stays contiguous on both sides wins.
+// Keys that appear on many deleted lines, such as a lone brace, only keep
+// their first few positions, so the pass stays linear in the number of
+// changed lines however many small hunks the diff has.
+class MoveDetector {
+  enum { MAX_POSITIONS = 16 };
+
+ public:
+  explicit MoveDetector(const uint64_t minLines = 3) : minLines_(minLines) {}
+
+  template <typename LineVector>
+  void detect(const edit_runs_t& runs, const LineVector& src,
+              const LineVector& dst, moves_t& moves) const {
+    std::vector<uint64_t> deleted, inserted;
+    uint64_t srcIndex = 0, dstIndex = 0;
+    for (const auto& run : runs) {
+      for (uint64_t i = 0; i != run.count; ++i) {
+        if (run.op == ES_RETAIN) {
+          srcIndex += 1;
+          dstIndex += 1;
+        } else if (run.op == ES_DELETE) {
+          deleted.push_back(srcIndex++);
+        } else {
+          inserted.push_back(dstIndex++);
+        }
+      }
+    }
+    std::vector<uint64_t> deletedKeys(deleted.size());
+    std::unordered_map<uint64_t, std::vector<uint64_t>> index;
+    for (size_t i = 0; i != deleted.size(); ++i) {
+      deletedKeys[i] = looseHash(src[deleted[i]]);
+      std::vector<uint64_t>& positions = index[deletedKeys[i]];
+      if (positions.size() < MAX_POSITIONS) {
+        positions.push_back(i);
+      }
+    }
+    std::vector<uint64_t> insertedKeys(inserted.size());
+    for (size_t i = 0; i != inserted.size(); ++i) {
+      insertedKeys[i] = looseHash(dst[inserted[i]]);
+    }
+
+    moves_t movesTemp;
+    std::vector<bool> used(deleted.size(), false);
+    for (size_t i = 0; i < inserted.size();) {
+      auto found = index.find(insertedKeys[i]);
+      uint64_t bestLength = 0;
+      uint64_t bestPosition = 0;
+      if (found != index.end() && dst[inserted[i]]->size != 0) {
+        for (uint64_t position : found->second) {
+          uint64_t length = 0;
+          for (; i + length < inserted.size() &&
+                 position + length < deleted.size() &&
+                 !used[position + length] &&
+                 insertedKeys[i + length] == deletedKeys[position + length] &&
+                 inserted[i + length] == inserted[i] + length &&
+                 deleted[position + length] == deleted[position] + length;
+               ++length) {
+          }
+          if (length > bestLength) {
+            bestLength = length;
+            bestPosition = position;
+          }
+        }
+      }
+      if (bestLength < minLines_) {
+        i += 1;
+        continue;
+      }
+      bool exact = true;
+      for (uint64_t k = 0; k != bestLength; ++k) {
+        used[bestPosition + k] = true;
+        exact = exact && src[deleted[bestPosition + k]] ==
+                             dst[inserted[i + k]];
+      }
+      movesTemp.push_back(
+          MovedBlock{deleted[bestPosition], inserted[i], bestLength, exact});
+      i += bestLength;
+    }
+    moves.swap(movesTemp);
+  }
+
+ private:
+  // Hash of the line with spaces, tabs and carriage returns dropped.
+  static uint64_t looseHash(const Line* line) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i != line->size; ++i) {
+      char c = line->data[i];
+      if (c != ' ' && c != '\t' && c != '\r') {
+        h = (h ^ static_cast<unsigned char>(c)) * 0x100000001b3ULL;
+      }
+    }
+    return h;
+  }
+
+ private:
+  uint64_t minLines_;
+};
+
+}  // namespace mydiff
+
+#endif
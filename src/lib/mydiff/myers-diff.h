@@ -2,10 +2,15 @@
 #define _MYERS_DIFF_H_
 
 #include <algorithm>
+#include <cstdint>
+#include <functional>
 #include <iostream>
 #include <iterator>
+#include <memory>
 #include <vector>
 
+#include "trace.h"
+
 namespace mydiff {
 
 enum EDIT_SCRIPT { ES_RETAIN, ES_DELETE, ES_INSERT };
@@ -14,58 +19,157 @@ template <typename Iter>
 using iter_dif_t = typename std::iterator_traits<Iter>::difference_type;
 
 template <typename BIter>
-using ses_t = std::vector<std::pair<EDIT_SCRIPT, iter_dif_t<BIter>>>;
+using ses_value_t = std::pair<EDIT_SCRIPT, iter_dif_t<BIter>>;
+
+// The SES allocator is also used for the engine's own workspace, so handing
+// in a vector backed by an arena keeps a whole diff job inside that arena.
+template <typename BIter, typename Alloc = std::allocator<ses_value_t<BIter>>>
+using ses_t = std::vector<ses_value_t<BIter>, Alloc>;
 
-template <typename BIter, typename EqualTo>
+template <typename BIter, typename EqualTo, typename Alloc>
 iter_dif_t<BIter> shortestEditScript(BIter first1,
                                      const iter_dif_t<BIter> srcOffset,
                                      const iter_dif_t<BIter> N, BIter first2,
                                      const iter_dif_t<BIter> dstOffset,
                                      const iter_dif_t<BIter> M,
-                                     ses_t<BIter>& ses, const EqualTo& equalTo);
+                                     ses_t<BIter, Alloc>& ses,
+                                     const EqualTo& equalTo);
 
-template <typename BIter, typename EqualTo>
+// Normally driven through shortestEditScript(), which sizes a fresh engine
+// for each call. Callers running many diffs can keep one MyersDiff per
+// thread and call diff() repeatedly: its V arrays only ever grow, so a warm
+// engine allocates nothing but the returned SES.
+template <typename BIter, typename EqualTo,
+          typename Alloc = std::allocator<ses_value_t<BIter>>>
 class MyersDiff {
-  friend iter_dif_t<BIter> shortestEditScript<BIter, EqualTo>(
+  friend iter_dif_t<BIter> shortestEditScript<BIter, EqualTo, Alloc>(
       BIter first1, const iter_dif_t<BIter> srcOffset,
       const iter_dif_t<BIter> N, BIter first2,
       const iter_dif_t<BIter> dstOffset, const iter_dif_t<BIter> M,
-      ses_t<BIter>& ses, const EqualTo& equalTo);
+      ses_t<BIter, Alloc>& ses, const EqualTo& equalTo);
 
  private:
   typedef typename std::iterator_traits<BIter>::value_type value_type;
   typedef typename std::iterator_traits<BIter>::difference_type difference_type;
   typedef difference_type diff_t;
   typedef std::pair<diff_t, diff_t> point_t;
-  typedef ses_t<BIter> ses_t;
+  typedef mydiff::ses_t<BIter, Alloc> script_t;
+  typedef typename std::allocator_traits<Alloc>::template rebind_alloc<diff_t>
+      diff_alloc_t;
+
+ public:
+  explicit MyersDiff(const Alloc& alloc = Alloc())
+      : forward(0, alloc), reverse(0, alloc) {}
+
+  diff_t diff(BIter first1, BIter last1, BIter first2, BIter last2,
+              script_t& ses, const EqualTo& equalTo) {
+    diff_t N = std::distance(first1, last1);
+    diff_t M = std::distance(first2, last2);
+    forward.reserve((N + M + 1) / 2);
+    reverse.reserve((N + M + 1) / 2);
+    return shortestEditScript(first1, 0, N, first2, 0, M, ses, equalTo);
+  }
+
+  // Lazy form of diff(): calls `visitor(op, count)` with the runs of the
+  // script in order as the divide and conquer proceeds, without building
+  // the script. The common prefix is reported before any search starts; a
+  // run is only passed on once it is complete. As soon as the visitor
+  // returns false the remaining subproblems are abandoned and visit()
+  // returns false.
+  template <typename Visitor>
+  bool visit(BIter first1, BIter last1, BIter first2, BIter last2,
+             const EqualTo& equalTo, Visitor visitor) {
+    RunSink<Visitor> sink(visitor);
+    for (; first1 != last1 && first2 != last2 && equalTo(*first1, *first2);
+         ++first1, ++first2) {
+      sink.emplace_back(ES_RETAIN, 0);
+    }
+    diff_t N = std::distance(first1, last1);
+    diff_t M = std::distance(first2, last2);
+    forward.reserve((N + M + 1) / 2);
+    reverse.reserve((N + M + 1) / 2);
+    shortestEditScriptImple(first1, 0, N, first2, 0, M, sink, equalTo);
+    return sink.finish();
+  }
+
+ private:
+  // Collapses the entries of the script into runs on their way to a
+  // visitor and records when the visitor asks to stop.
+  template <typename Visitor>
+  class RunSink {
+   public:
+    explicit RunSink(Visitor& visitor)
+        : visitor_(visitor), op_(ES_RETAIN), count_(0), stopped_(false) {}
+
+    void emplace_back(const EDIT_SCRIPT op, diff_t) {
+      if (op != op_ && count_ != 0) {
+        flush();
+      }
+      op_ = op;
+      count_ += 1;
+    }
+
+    bool stopped() const { return stopped_; }
+
+    bool finish() {
+      if (count_ != 0) {
+        flush();
+      }
+      return !stopped_;
+    }
+
+   private:
+    void flush() {
+      if (!stopped_ && !visitor_(op_, static_cast<uint64_t>(count_))) {
+        stopped_ = true;
+      }
+      count_ = 0;
+    }
+
+   private:
+    Visitor& visitor_;
+    EDIT_SCRIPT op_;
+    diff_t count_;
+    bool stopped_;
+  };
+
+ private:
 
   class IntIndexVector {
    public:
-    IntIndexVector(const diff_t maxPath)
-        : offset_(maxPath), vec_(2 * maxPath + 1, 0) {}
+    IntIndexVector(const diff_t maxPath, const Alloc& alloc)
+        : offset_(maxPath), vec_(2 * maxPath + 1, 0, diff_alloc_t(alloc)) {}
 
     diff_t& operator[](const diff_t index) { return vec_[index + offset_]; }
 
+    void reserve(const diff_t maxPath) {
+      if (maxPath > offset_) {
+        offset_ = maxPath;
+        vec_.assign(2 * maxPath + 1, 0);
+      }
+    }
+
     void reset(const diff_t maxK) {
       std::fill_n(vec_.begin() + (offset_ + (-maxK)), 2 * maxK + 1, 0);
     }
 
    private:
     diff_t offset_;
-    std::vector<diff_t> vec_;
+    std::vector<diff_t, diff_alloc_t> vec_;
   };
 
  private:
-  MyersDiff(const diff_t maxPath) : forward(maxPath), reverse(maxPath){};
+  MyersDiff(const diff_t maxPath, const Alloc& alloc)
+      : forward(maxPath, alloc), reverse(maxPath, alloc){};
 
   diff_t shortestEditScript(BIter first1, const diff_t srcOffset,
                             const diff_t N, BIter first2,
-                            const diff_t dstOffset, const diff_t M, ses_t& ses,
-                            const EqualTo& equalTo) {
-    ses_t tmpSes;
+                            const diff_t dstOffset, const diff_t M,
+                            script_t& ses, const EqualTo& equalTo) {
+    script_t tmpSes(ses.get_allocator());
     shortestEditScriptImple(first1, srcOffset, N, first2, dstOffset, M, tmpSes,
                             equalTo);
-    diff_t lcs = ((M + N) - tmpSes.size()) / 2;
+    diff_t lcs = (M + N) - tmpSes.size();
     ses.swap(tmpSes);
     return lcs;
   }
@@ -75,10 +179,16 @@ class MyersDiff {
     return offset + (index - 1);
   }
 
+  // Appends the script to `ses`, which is either a script_t or a RunSink
+  // that may abandon the remaining subproblems.
+  template <typename Sink>
   diff_t shortestEditScriptImple(BIter src, const diff_t srcOffset,
                                  const diff_t N, BIter dst,
                                  const diff_t dstOffset, const diff_t M,
-                                 ses_t& ses, const EqualTo& equalTo) {
+                                 Sink& ses, const EqualTo& equalTo) {
+    if (abandoned(ses)) {
+      return 0;
+    }
     if (M == 0) {
       if (N > 0) {
         for (diff_t i = 0; i < N; ++i) {
@@ -95,9 +205,15 @@ class MyersDiff {
         }
         return M;
       } else {
+        TraceScope subproblem("subproblem", "N", N, "M", M);
         point_t head, tail;
-        diff_t d = findMiddleSnake(src, srcOffset, N, dst, dstOffset, M, head,
-                                   tail, equalTo);
+        diff_t d;
+        {
+          TraceScope trace("findMiddleSnake", "N", N, "M", M);
+          d = findMiddleSnake(src, srcOffset, N, dst, dstOffset, M, head, tail,
+                              equalTo);
+          trace.arg("D", d);
+        }
         if (d == 0) {
           for (diff_t i = head.first + 1; i <= tail.first; ++i) {
             ses.emplace_back(ES_RETAIN, absIndex(srcOffset, i));
@@ -140,6 +256,13 @@ class MyersDiff {
     return 0;
   }
 
+  static bool abandoned(const script_t&) { return false; }
+
+  template <typename Visitor>
+  static bool abandoned(const RunSink<Visitor>& sink) {
+    return sink.stopped();
+  }
+
   diff_t findMiddleSnake(BIter src, const diff_t srcOffset, const diff_t N,
                          BIter dst, const diff_t dstOffset, const diff_t M,
                          point_t& head, point_t& tail, const EqualTo& equalTo) {
@@ -247,40 +370,60 @@ class MyersDiff {
   IntIndexVector reverse;
 };
 
-template <typename BIter, typename EqualTo>
+template <typename BIter, typename EqualTo, typename Alloc>
 iter_dif_t<BIter> shortestEditScript(BIter first1, BIter last1, BIter first2,
-                                     BIter last2, ses_t<BIter>& ses,
+                                     BIter last2, ses_t<BIter, Alloc>& ses,
                                      const EqualTo& comp) {
   return shortestEditScript(first1, 0, std::distance(first1, last1), first2, 0,
                             std::distance(first2, last2), ses, comp);
 }
 
-template <typename BIter>
+template <typename BIter, typename Alloc>
 iter_dif_t<BIter> shortestEditScript(BIter first1, BIter last1, BIter first2,
-                                     BIter last2, ses_t<BIter>& ses) {
+                                     BIter last2, ses_t<BIter, Alloc>& ses) {
   return shortestEditScript(
       first1, last1, first2, last2, ses,
       std::equal_to<typename std::iterator_traits<BIter>::value_type>());
 }
 
-template <typename BIter, typename EqualTo>
+template <typename BIter, typename EqualTo, typename Alloc>
 iter_dif_t<BIter> shortestEditScript(
     BIter first1, const iter_dif_t<BIter> srcOffset, const iter_dif_t<BIter> N,
     BIter first2, const iter_dif_t<BIter> dstOffset, const iter_dif_t<BIter> M,
-    ses_t<BIter>& ses, const EqualTo& equalTo) {
+    ses_t<BIter, Alloc>& ses, const EqualTo& equalTo) {
   iter_dif_t<BIter> maxPath = (N + M + 1) / 2;
-  MyersDiff<BIter, EqualTo> mydiff(maxPath);
+  MyersDiff<BIter, EqualTo, Alloc> mydiff(maxPath, ses.get_allocator());
   return mydiff.shortestEditScript(first1, srcOffset, N, first2, dstOffset, M,
                                    ses, equalTo);
 }
 
-template <typename BIter>
+// Calls `visitor(EDIT_SCRIPT op, uint64_t count)` for the runs of the SES of
+// [first1, last1) and [first2, last2) in order, computing only as much of
+// the script as the visitor consumes: returning false from the visitor
+// abandons the rest. Returns whether the whole script was visited.
+template <typename BIter, typename EqualTo, typename Visitor>
+bool visitEditRuns(BIter first1, BIter last1, BIter first2, BIter last2,
+                   const EqualTo& equalTo, Visitor visitor) {
+  MyersDiff<BIter, EqualTo> mydiff;
+  return mydiff.visit(first1, last1, first2, last2, equalTo, visitor);
+}
+
+template <typename BIter, typename Visitor>
+bool visitEditRuns(BIter first1, BIter last1, BIter first2, BIter last2,
+                   Visitor visitor) {
+  return visitEditRuns(
+      first1, last1, first2, last2,
+      std::equal_to<typename std::iterator_traits<BIter>::value_type>(),
+      visitor);
+}
+
+template <typename BIter, typename Alloc>
 iter_dif_t<BIter> shortestEditScript(BIter first1,
                                      const iter_dif_t<BIter> srcOffset,
                                      const iter_dif_t<BIter> N, BIter first2,
                                      const iter_dif_t<BIter> dstOffset,
                                      const iter_dif_t<BIter> M,
-                                     ses_t<BIter>& ses) {
+                                     ses_t<BIter, Alloc>& ses) {
   return shortestEditScript(
       first1, srcOffset, N, first2, dstOffset, M, ses,
       std::equal_to<typename std::iterator_traits<BIter>::value_type>());
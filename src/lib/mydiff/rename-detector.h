@@ -0,0 +1,327 @@
+#ifndef _MYDIFF_RENAME_DETECTOR_H_
+#define _MYDIFF_RENAME_DETECTOR_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "edit-distance.h"
+#include "line-interner.h"
+#include "mapped-file.h"
+#include "thread-pool.h"
+
+namespace mydiff {
+
+// Pairs removed or existing source files with new target files whose
+// contents are similar, without diffing every pair. Each file is summarised
+// by a one-permutation MinHash over the hashes of its distinct lines. The
+// sketches of the sources are banded into a locality-sensitive index, so a
+// target only meets sources that agree with it on a whole band; the full
+// sketch then estimates their similarity, and only the few best candidates
+// get an exact edit distance, searched no further than the minimum score
+// allows. The score is 100 * 2 * LCS / (N + M) over lines, exact duplicates
+// score 100.
+class RenameDetector {
+  enum { SKETCH_SIZE = 32, BAND_ROWS = 2 };
+  enum { BAND_COUNT = SKETCH_SIZE / BAND_ROWS };
+  // Candidates diffed per target, and the largest LSH bucket still scanned;
+  // a bigger bucket means the band is shared boilerplate and says little.
+  enum { MAX_CONFIRM = 8, MAX_BUCKET = 256 };
+  // How far below the minimum score a sketch estimate may fall and still be
+  // confirmed; the estimate of a 32 slot sketch is coarse.
+  enum { ESTIMATE_SLACK = 15 };
+  enum { SKETCH_BATCH = 64 };
+
+  typedef std::vector<uint64_t> hashes_t;
+  typedef hashes_t::const_iterator hash_iter;
+  typedef EditDistance<hash_iter, std::equal_to<uint64_t>> engine_t;
+
+  struct Sketch {
+    uint32_t mins[SKETCH_SIZE];
+    uint64_t contentHash;
+    uint64_t lines;
+    bool valid;
+  };
+
+  struct Candidate {
+    int score;
+    size_t source;
+    size_t target;
+  };
+
+ public:
+  struct Match {
+    size_t source;
+    size_t target;
+    int score;
+    bool copy;
+  };
+
+  RenameDetector(const int minScore, const size_t threads)
+      : minScore_(minScore), pool_(threads) {}
+
+  // `removed[i]` tells whether sources[i] is gone from the new tree. Removed
+  // sources are renamed to their best target, at most once; the remaining
+  // matches are reported as copies when `findCopies` is set. Every target
+  // appears in at most one match.
+  bool detect(const std::vector<std::string>& sources,
+              const std::vector<bool>& removed,
+              const std::vector<std::string>& targets, const bool findCopies,
+              std::vector<Match>& matches) {
+    std::vector<Sketch> sourceSketches(sources.size());
+    std::vector<Sketch> targetSketches(targets.size());
+    sketchAll(sources, sourceSketches);
+    sketchAll(targets, targetSketches);
+    pool_.wait();
+    buildIndex(sourceSketches);
+
+    std::vector<std::vector<Candidate>> found(targets.size());
+    std::vector<engine_t> engines(pool_.size());
+    for (size_t first = 0; first < targets.size(); first += SKETCH_BATCH) {
+      size_t last = std::min(first + size_t(SKETCH_BATCH), targets.size());
+      pool_.submit([&, first, last](size_t worker) {
+        std::vector<size_t> seen;
+        for (size_t target = first; target != last; ++target) {
+          findSources(sources, sourceSketches, targets[target],
+                      targetSketches[target], target, engines[worker], seen,
+                      found[target]);
+        }
+      });
+    }
+    pool_.wait();
+
+    std::vector<Candidate> candidates;
+    for (const auto& list : found) {
+      candidates.insert(candidates.end(), list.begin(), list.end());
+    }
+    std::sort(candidates.begin(), candidates.end(),
+              [](const Candidate& a, const Candidate& b) {
+                if (a.score != b.score) return a.score > b.score;
+                if (a.target != b.target) return a.target < b.target;
+                return a.source < b.source;
+              });
+    std::vector<bool> renamed(sources.size(), false);
+    std::vector<bool> matched(targets.size(), false);
+    std::vector<Match> matchesTemp;
+    for (const auto& candidate : candidates) {
+      if (matched[candidate.target]) {
+        continue;
+      }
+      bool copy = !removed[candidate.source] || renamed[candidate.source];
+      if (copy && !findCopies) {
+        continue;
+      }
+      renamed[candidate.source] = renamed[candidate.source] || !copy;
+      matched[candidate.target] = true;
+      matchesTemp.push_back(
+          Match{candidate.source, candidate.target, candidate.score, copy});
+    }
+    matches.swap(matchesTemp);
+    return true;
+  }
+
+ private:
+  void sketchAll(const std::vector<std::string>& files,
+                 std::vector<Sketch>& sketches) {
+    for (size_t first = 0; first < files.size(); first += SKETCH_BATCH) {
+      size_t last = std::min(first + size_t(SKETCH_BATCH), files.size());
+      pool_.submit([&files, &sketches, first, last](size_t) {
+        for (size_t i = first; i != last; ++i) {
+          sketchFile(files[i], sketches[i]);
+        }
+      });
+    }
+  }
+
+  // An unreadable or empty file gets an invalid sketch and is never paired.
+  static void sketchFile(const std::string& file, Sketch& sketch) {
+    sketch.valid = false;
+    MappedFile mapped;
+    if (!mapped.open(file)) {
+      std::cerr << "mydiff: rename: open error on " << file << std::endl;
+      return;
+    }
+    if (mapped.size() == 0) {
+      return;
+    }
+    std::fill_n(sketch.mins, SKETCH_SIZE, UINT32_MAX);
+    sketch.lines = splitLines(mapped, [&sketch](const uint64_t hash) {
+      uint64_t h = mix(hash);
+      uint32_t& slot = sketch.mins[h % SKETCH_SIZE];
+      slot = std::min(slot, static_cast<uint32_t>(h >> 32));
+    });
+    sketch.contentHash = hashBytes(mapped.data(), mapped.size());
+    // Fill empty slots from the next filled one, offset by the distance, so
+    // small files still get a full sketch that compares slot by slot.
+    for (size_t i = 0; i != SKETCH_SIZE; ++i) {
+      for (size_t step = 1; sketch.mins[i] == UINT32_MAX; ++step) {
+        uint32_t next = sketch.mins[(i + step) % SKETCH_SIZE];
+        if (next != UINT32_MAX) {
+          sketch.mins[i] = next + static_cast<uint32_t>(step * 0x9e3779b9U);
+        }
+      }
+    }
+    sketch.valid = true;
+  }
+
+  // Calls `onLine(hash)` for each line of the file with getline semantics
+  // and returns the number of lines.
+  template <typename OnLine>
+  static uint64_t splitLines(const MappedFile& mapped, const OnLine& onLine) {
+    const char* first = mapped.data();
+    const char* last = first + mapped.size();
+    uint64_t lines = 0;
+    for (; first != last; ++lines) {
+      const char* newline = static_cast<const char*>(
+          std::memchr(first, '\n', last - first));
+      const char* end = newline == nullptr ? last : newline;
+      onLine(hashBytes(first, end - first));
+      first = newline == nullptr ? last : newline + 1;
+    }
+    return lines;
+  }
+
+  static uint64_t mix(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    return h ^ (h >> 33);
+  }
+
+  static uint64_t bandKey(const Sketch& sketch, const size_t band) {
+    uint64_t key = mix(band + 1);
+    for (size_t row = 0; row != BAND_ROWS; ++row) {
+      key = mix(key ^ sketch.mins[band * BAND_ROWS + row]);
+    }
+    return key;
+  }
+
+  void buildIndex(const std::vector<Sketch>& sketches) {
+    bands_.clear();
+    exact_.clear();
+    for (size_t i = 0; i != sketches.size(); ++i) {
+      if (!sketches[i].valid) {
+        continue;
+      }
+      exact_[sketches[i].contentHash].push_back(i);
+      for (size_t band = 0; band != BAND_COUNT; ++band) {
+        bands_[bandKey(sketches[i], band)].push_back(i);
+      }
+    }
+  }
+
+  void findSources(const std::vector<std::string>& sources,
+                   const std::vector<Sketch>& sourceSketches,
+                   const std::string& target, const Sketch& sketch,
+                   const size_t targetIndex, engine_t& engine,
+                   std::vector<size_t>& seen,
+                   std::vector<Candidate>& found) const {
+    if (!sketch.valid) {
+      return;
+    }
+    auto exact = exact_.find(sketch.contentHash);
+    if (exact != exact_.end()) {
+      for (size_t source : exact->second) {
+        if (sameContents(sources[source], target)) {
+          found.push_back(Candidate{100, source, targetIndex});
+        }
+      }
+      if (!found.empty()) {
+        return;
+      }
+    }
+    seen.clear();
+    for (size_t band = 0; band != BAND_COUNT; ++band) {
+      auto bucket = bands_.find(bandKey(sketch, band));
+      if (bucket != bands_.end() && bucket->second.size() <= MAX_BUCKET) {
+        seen.insert(seen.end(), bucket->second.begin(), bucket->second.end());
+      }
+    }
+    std::sort(seen.begin(), seen.end());
+    seen.erase(std::unique(seen.begin(), seen.end()), seen.end());
+
+    std::vector<std::pair<int, size_t>> estimates;
+    for (size_t source : seen) {
+      const Sketch& other = sourceSketches[source];
+      // Line counts alone bound the score from above.
+      uint64_t lines = sketch.lines + other.lines;
+      if (200 * std::min(sketch.lines, other.lines) < minScore_ * lines) {
+        continue;
+      }
+      int agree = 0;
+      for (size_t i = 0; i != SKETCH_SIZE; ++i) {
+        agree += sketch.mins[i] == other.mins[i];
+      }
+      // Jaccard J of the line sets gives a score estimate of 2J / (1 + J).
+      int estimate = 200 * agree / (SKETCH_SIZE + agree);
+      if (estimate + ESTIMATE_SLACK >= minScore_) {
+        estimates.push_back(std::make_pair(estimate, source));
+      }
+    }
+    std::sort(estimates.begin(), estimates.end(),
+              [](const std::pair<int, size_t>& a,
+                 const std::pair<int, size_t>& b) {
+                return a.first != b.first ? a.first > b.first
+                                          : a.second < b.second;
+              });
+    if (estimates.size() > MAX_CONFIRM) {
+      estimates.resize(MAX_CONFIRM);
+    }
+    hashes_t targetLines;
+    if (!estimates.empty() && !loadHashes(target, targetLines)) {
+      return;
+    }
+    hashes_t sourceLines;
+    for (const auto& estimate : estimates) {
+      if (!loadHashes(sources[estimate.second], sourceLines)) {
+        continue;
+      }
+      int score = similarity(engine, sourceLines, targetLines, minScore_);
+      if (score >= minScore_) {
+        found.push_back(Candidate{score, estimate.second, targetIndex});
+      }
+    }
+  }
+
+  // The score, or -1 once the search shows it is below `minScore`. With
+  // S = N + M the score is 100 * (S - D) / S, so only D up to
+  // S * (100 - minScore) / 100 needs to be searched for.
+  static int similarity(engine_t& engine, const hashes_t& src,
+                        const hashes_t& dst, const int minScore) {
+    iter_dif_t<hash_iter> lines = src.size() + dst.size();
+    iter_dif_t<hash_iter> limit = lines * (100 - minScore) / 100;
+    iter_dif_t<hash_iter> d = engine.distanceWithin(
+        src.begin(), src.end(), dst.begin(), dst.end(), limit);
+    if (d > limit) {
+      return -1;
+    }
+    return static_cast<int>(100 * (lines - d) / lines);
+  }
+
+  static bool loadHashes(const std::string& file, hashes_t& lines) {
+    MappedFile mapped;
+    if (!mapped.open(file)) {
+      std::cerr << "mydiff: rename: open error on " << file << std::endl;
+      return false;
+    }
+    lines.clear();
+    splitLines(mapped,
+               [&lines](const uint64_t hash) { lines.push_back(hash); });
+    return true;
+  }
+
+ private:
+  int minScore_;
+  ThreadPool pool_;
+  std::unordered_map<uint64_t, std::vector<size_t>> bands_;
+  std::unordered_map<uint64_t, std::vector<size_t>> exact_;
+};
+
+}  // namespace mydiff
+
+#endif
@@ -0,0 +1,211 @@
+#ifndef _MYDIFF_SHA256_H_
+#define _MYDIFF_SHA256_H_
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+
+namespace mydiff {
+
+// FIPS 180-4 SHA-256, used to content-address inputs and cached scripts.
+class Sha256 {
+ public:
+  enum { DIGEST_SIZE = 32 };
+
+  Sha256() { reset(); }
+
+  void reset() {
+    static const uint32_t init[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372,
+                                     0xa54ff53a, 0x510e527f, 0x9b05688c,
+                                     0x1f83d9ab, 0x5be0cd19};
+    std::memcpy(state_, init, sizeof(state_));
+    length_ = 0;
+    bufferSize_ = 0;
+  }
+
+  Sha256& update(const void* data, size_t size) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    length_ += size;
+    if (bufferSize_ != 0) {
+      size_t fill = std::min(size, sizeof(buffer_) - bufferSize_);
+      std::memcpy(buffer_ + bufferSize_, bytes, fill);
+      bufferSize_ += fill;
+      bytes += fill;
+      size -= fill;
+      if (bufferSize_ != sizeof(buffer_)) {
+        return *this;
+      }
+      transform(buffer_);
+      bufferSize_ = 0;
+    }
+    for (; size >= sizeof(buffer_); size -= sizeof(buffer_)) {
+      transform(bytes);
+      bytes += sizeof(buffer_);
+    }
+    std::memcpy(buffer_, bytes, size);
+    bufferSize_ = size;
+    return *this;
+  }
+
+  Sha256& update(const std::string& data) {
+    return update(data.data(), data.size());
+  }
+
+  void final(unsigned char digest[DIGEST_SIZE]) {
+    uint64_t bitLength = length_ * 8;
+    unsigned char pad = 0x80;
+    update(&pad, 1);
+    pad = 0;
+    for (; bufferSize_ != 56;) {
+      update(&pad, 1);
+    }
+    unsigned char lengthBytes[8];
+    for (int i = 0; i < 8; ++i) {
+      lengthBytes[i] = static_cast<unsigned char>(bitLength >> (56 - 8 * i));
+    }
+    update(lengthBytes, 8);
+    for (int i = 0; i < 8; ++i) {
+      digest[4 * i] = static_cast<unsigned char>(state_[i] >> 24);
+      digest[4 * i + 1] = static_cast<unsigned char>(state_[i] >> 16);
+      digest[4 * i + 2] = static_cast<unsigned char>(state_[i] >> 8);
+      digest[4 * i + 3] = static_cast<unsigned char>(state_[i]);
+    }
+    reset();
+  }
+
+  std::string hexDigest() {
+    unsigned char digest[DIGEST_SIZE];
+    final(digest);
+    return toHex(digest, DIGEST_SIZE);
+  }
+
+  static bool digestFile(const std::string& file,
+                         unsigned char digest[DIGEST_SIZE]) {
+    int fd = ::open(file.c_str(), O_RDONLY);
+    if (fd < 0) {
+      return false;
+    }
+    const size_t bufferSize = 1 << 20;
+    std::unique_ptr<char[]> buffer(new char[bufferSize]);
+    Sha256 sha;
+    for (;;) {
+      ssize_t n = read(fd, buffer.get(), bufferSize);
+      if (n < 0) {
+        if (errno == EINTR) continue;
+        ::close(fd);
+        return false;
+      }
+      if (n == 0) break;
+      sha.update(buffer.get(), n);
+    }
+    ::close(fd);
+    sha.final(digest);
+    return true;
+  }
+
+  // False unless `hex` is exactly `size` bytes in lowercase hex.
+  static bool fromHex(const std::string& hex, unsigned char* bytes,
+                      size_t size) {
+    if (hex.size() != size * 2) {
+      return false;
+    }
+    for (size_t i = 0; i < hex.size(); ++i) {
+      char c = hex[i];
+      int digit = c >= '0' && c <= '9' ? c - '0'
+                  : c >= 'a' && c <= 'f' ? c - 'a' + 10
+                                         : -1;
+      if (digit < 0) {
+        return false;
+      }
+      bytes[i / 2] = static_cast<unsigned char>(
+          i % 2 == 0 ? digit << 4 : bytes[i / 2] | digit);
+    }
+    return true;
+  }
+
+  static std::string toHex(const unsigned char* bytes, size_t size) {
+    static const char digits[] = "0123456789abcdef";
+    std::string hex;
+    hex.reserve(size * 2);
+    for (size_t i = 0; i < size; ++i) {
+      hex.push_back(digits[bytes[i] >> 4]);
+      hex.push_back(digits[bytes[i] & 0xf]);
+    }
+    return hex;
+  }
+
+ private:
+  static uint32_t rotr(uint32_t x, int n) {
+    return (x >> n) | (x << (32 - n));
+  }
+
+  void transform(const unsigned char* block) {
+    static const uint32_t k[64] = {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+        0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+        0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+        0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+        0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+        0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+        0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+        0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+        0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+    uint32_t w[64];
+    for (int i = 0; i < 16; ++i) {
+      w[i] = (uint32_t(block[4 * i]) << 24) |
+             (uint32_t(block[4 * i + 1]) << 16) |
+             (uint32_t(block[4 * i + 2]) << 8) | uint32_t(block[4 * i + 3]);
+    }
+    for (int i = 16; i < 64; ++i) {
+      uint32_t s0 =
+          rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+      uint32_t s1 =
+          rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+      w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    uint32_t a = state_[0], b = state_[1], c = state_[2], d = state_[3];
+    uint32_t e = state_[4], f = state_[5], g = state_[6], h = state_[7];
+    for (int i = 0; i < 64; ++i) {
+      uint32_t s1 = rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25);
+      uint32_t ch = (e & f) ^ (~e & g);
+      uint32_t t1 = h + s1 + ch + k[i] + w[i];
+      uint32_t s0 = rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22);
+      uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+      uint32_t t2 = s0 + maj;
+      h = g;
+      g = f;
+      f = e;
+      e = d + t1;
+      d = c;
+      c = b;
+      b = a;
+      a = t1 + t2;
+    }
+    state_[0] += a;
+    state_[1] += b;
+    state_[2] += c;
+    state_[3] += d;
+    state_[4] += e;
+    state_[5] += f;
+    state_[6] += g;
+    state_[7] += h;
+  }
+
+ private:
+  uint32_t state_[8];
+  uint64_t length_;
+  unsigned char buffer_[64];
+  size_t bufferSize_;
+};
+
+}  // namespace mydiff
+
+#endif
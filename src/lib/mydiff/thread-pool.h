@@ -0,0 +1,99 @@
+#ifndef _MYDIFF_THREAD_POOL_H_
+#define _MYDIFF_THREAD_POOL_H_
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace mydiff {
+
+// Fixed set of worker threads draining one task queue. Each task receives
+// the index of the worker running it, so callers can keep per-worker state
+// such as a warm MyersDiff in a plain vector indexed by worker.
+class ThreadPool {
+ public:
+  typedef std::function<void(size_t)> task_t;
+
+  explicit ThreadPool(size_t threads) : pending_(0), stopping_(false) {
+    if (threads == 0) {
+      threads = defaultThreads();
+    }
+    for (size_t i = 0; i != threads; ++i) {
+      workers_.emplace_back([this, i] { run(i); });
+    }
+  }
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+    }
+    taskReady_.notify_all();
+    for (auto& worker : workers_) {
+      worker.join();
+    }
+  }
+
+  ThreadPool(const ThreadPool&) = delete;
+
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  static size_t defaultThreads() {
+    size_t threads = std::thread::hardware_concurrency();
+    return threads == 0 ? 1 : threads;
+  }
+
+  size_t size() const { return workers_.size(); }
+
+  void submit(task_t task) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      tasks_.push_back(std::move(task));
+      pending_ += 1;
+    }
+    taskReady_.notify_one();
+  }
+
+  // Blocks until every submitted task has finished.
+  void wait() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    allDone_.wait(lock, [this] { return pending_ == 0; });
+  }
+
+ private:
+  void run(const size_t index) {
+    for (;;) {
+      task_t task;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        taskReady_.wait(lock, [this] { return stopping_ || !tasks_.empty(); });
+        if (tasks_.empty()) {
+          return;
+        }
+        task = std::move(tasks_.front());
+        tasks_.pop_front();
+      }
+      task(index);
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (--pending_ == 0) {
+        allDone_.notify_all();
+      }
+    }
+  }
+
+ private:
+  std::vector<std::thread> workers_;
+  std::deque<task_t> tasks_;
+  size_t pending_;
+  bool stopping_;
+  std::mutex mutex_;
+  std::condition_variable taskReady_;
+  std::condition_variable allDone_;
+};
+
+}  // namespace mydiff
+
+#endif
@@ -0,0 +1,155 @@
+#ifndef _MYDIFF_TOKENIZER_H_
+#define _MYDIFF_TOKENIZER_H_
+
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "line-interner.h"
+
+namespace mydiff {
+
+// A token is a span of the mapped input, never a copy. Tokens of a file
+// tile it without gaps, so an edit over tokens maps straight back to a byte
+// range. The size is 32-bit to keep a token in 16 bytes; Tokenizer::split()
+// rejects inputs with longer tokens.
+struct Token {
+  const char* data;
+  uint32_t size;
+  uint32_t hash;
+};
+
+struct TokenEqual {
+  bool operator()(const Token& a, const Token& b) const {
+    return a.hash == b.hash && a.size == b.size &&
+           std::memcmp(a.data, b.data, a.size) == 0;
+  }
+};
+
+struct TokenHash {
+  size_t operator()(const Token& token) const { return token.hash; }
+};
+
+typedef std::vector<Token> tokens_t;
+
+enum TOKEN_MODE { TM_LINES, TM_BYTES, TM_UTF8, TM_WORDS, TM_DELIMITERS };
+
+// Cuts a buffer into tokens for inputs where lines are the wrong unit, such
+// as minified JSON or SQL dumps on a single line:
+//
+//   bytes        every byte
+//   utf8         code points; a malformed byte stands alone
+//   words        runs of non-blanks and runs of blanks, alternately
+//   delims:SET   tokens ending after any byte of SET, as lines end at '\n'
+//
+// Byte mode needs no spans at all, the caller diffs the buffer itself.
+class Tokenizer {
+ public:
+  Tokenizer() : mode_(TM_LINES) { std::memset(delimiters_, 0, 256); }
+
+  bool parse(const std::string& spec) {
+    static const std::string prefix("delims:");
+    std::memset(delimiters_, 0, sizeof(delimiters_));
+    if (spec == "lines") {
+      mode_ = TM_LINES;
+    } else if (spec == "bytes") {
+      mode_ = TM_BYTES;
+    } else if (spec == "utf8") {
+      mode_ = TM_UTF8;
+    } else if (spec == "words") {
+      mode_ = TM_WORDS;
+    } else if (spec.compare(0, prefix.size(), prefix) == 0 &&
+               spec.size() > prefix.size()) {
+      mode_ = TM_DELIMITERS;
+      for (size_t i = prefix.size(); i != spec.size(); ++i) {
+        delimiters_[static_cast<unsigned char>(spec[i])] = true;
+      }
+    } else {
+      return false;
+    }
+    return true;
+  }
+
+  TOKEN_MODE mode() const { return mode_; }
+
+  // False, leaving `tokens` alone, if a token would be 4 GiB or longer.
+  bool split(const char* data, const size_t size, tokens_t& tokens) const {
+    tokens_t tokensTemp;
+    const char* first = data;
+    const char* last = data + size;
+    while (first != last) {
+      const char* end = tokenEnd(first, last);
+      size_t length = end - first;
+      if (length > std::numeric_limits<uint32_t>::max()) {
+        return false;
+      }
+      uint32_t hash = static_cast<uint32_t>(hashBytes(first, length));
+      tokensTemp.push_back(
+          Token{first, static_cast<uint32_t>(length), hash});
+      first = end;
+    }
+    tokens.swap(tokensTemp);
+    return true;
+  }
+
+ private:
+  const char* tokenEnd(const char* first, const char* last) const {
+    switch (mode_) {
+      case TM_BYTES:
+        return first + 1;
+      case TM_UTF8:
+        return utf8End(first, last);
+      case TM_WORDS: {
+        bool blank = isBlank(*first);
+        for (++first; first != last && isBlank(*first) == blank; ++first) {
+        }
+        return first;
+      }
+      case TM_DELIMITERS:
+        for (; first != last; ++first) {
+          if (delimiters_[static_cast<unsigned char>(*first)]) {
+            return first + 1;
+          }
+        }
+        return last;
+      default: {
+        const char* newline = static_cast<const char*>(
+            std::memchr(first, '\n', last - first));
+        return newline == nullptr ? last : newline + 1;
+      }
+    }
+  }
+
+  static const char* utf8End(const char* first, const char* last) {
+    unsigned char lead = static_cast<unsigned char>(*first);
+    size_t length = lead < 0x80           ? 1
+                    : (lead >> 5) == 0x6  ? 2
+                    : (lead >> 4) == 0xe  ? 3
+                    : (lead >> 3) == 0x1e ? 4
+                                          : 1;
+    if (static_cast<size_t>(last - first) < length) {
+      return first + 1;
+    }
+    for (size_t i = 1; i != length; ++i) {
+      if ((static_cast<unsigned char>(first[i]) & 0xc0) != 0x80) {
+        return first + 1;
+      }
+    }
+    return first + length;
+  }
+
+  static bool isBlank(const char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' ||
+           c == '\v';
+  }
+
+ private:
+  TOKEN_MODE mode_;
+  bool delimiters_[256];
+};
+
+}  // namespace mydiff
+
+#endif
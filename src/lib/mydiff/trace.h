@@ -0,0 +1,274 @@
+#ifndef _MYDIFF_TRACE_H_
+#define _MYDIFF_TRACE_H_
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace mydiff {
+
+// Process-wide recorder of timed scopes. It is compiled in everywhere and
+// switched on at run time; while it is off a TraceScope costs one relaxed
+// atomic load. When on, each thread appends finished scopes to its own
+// buffer without locking, up to a fixed number of events per thread, and
+// write() renders all buffers once the work is done: Chrome trace-event JSON
+// for chrome://tracing or Perfetto, or folded stacks for flamegraph.pl.
+class Tracer {
+ public:
+  enum { MAX_ARGS = 3, MAX_EVENTS_PER_THREAD = 1 << 18 };
+
+  struct Event {
+    const char* name;
+    uint64_t start;
+    uint64_t duration;
+    const char* keys[MAX_ARGS];
+    int64_t values[MAX_ARGS];
+    int args;
+  };
+
+  static bool enabled() {
+    return instance().enabled_.load(std::memory_order_relaxed);
+  }
+
+  static void enable() {
+    Tracer& tracer = instance();
+    tracer.origin_ = clock();
+    tracer.enabled_.store(true, std::memory_order_relaxed);
+  }
+
+  // Nanoseconds since enable().
+  static uint64_t now() { return clock() - instance().origin_; }
+
+  static void record(const Event& event) {
+    ThreadBuffer*& buffer = localBuffer();
+    if (buffer == nullptr) {
+      buffer = instance().newBuffer();
+    }
+    if (buffer->events.size() == MAX_EVENTS_PER_THREAD) {
+      buffer->dropped += 1;
+    } else {
+      buffer->events.push_back(event);
+    }
+  }
+
+  // Writes folded stacks when `file` ends in ".folded", Chrome JSON
+  // otherwise. Threads must no longer be recording.
+  static bool write(const std::string& file) {
+    std::ofstream out(file);
+    if (!out.is_open()) {
+      std::cerr << "mydiff: trace: open error on " << file << std::endl;
+      return false;
+    }
+    const std::string suffix(".folded");
+    bool folded = file.size() >= suffix.size() &&
+                  file.compare(file.size() - suffix.size(), suffix.size(),
+                               suffix) == 0;
+    if (folded) {
+      instance().writeFolded(out);
+    } else {
+      instance().writeChromeJson(out);
+    }
+    out.close();
+    if (!out) {
+      std::cerr << "mydiff: trace: write error on " << file << std::endl;
+      return false;
+    }
+    return true;
+  }
+
+ private:
+  struct ThreadBuffer {
+    size_t tid;
+    std::vector<Event> events;
+    uint64_t dropped;
+  };
+
+  Tracer() : enabled_(false), origin_(0) {}
+
+  static Tracer& instance() {
+    static Tracer tracer;
+    return tracer;
+  }
+
+  static ThreadBuffer*& localBuffer() {
+    static thread_local ThreadBuffer* buffer = nullptr;
+    return buffer;
+  }
+
+  static uint64_t clock() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+  }
+
+  // Buffers belong to the tracer, so they outlive short-lived loader threads.
+  ThreadBuffer* newBuffer() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    buffers_.emplace_back(new ThreadBuffer{buffers_.size() + 1, {}, 0});
+    return buffers_.back().get();
+  }
+
+  void writeChromeJson(std::ostream& out) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    out << "{\"traceEvents\":[";
+    const char* sep = "\n";
+    pid_t pid = getpid();
+    for (const auto& buffer : buffers_) {
+      for (const auto& event : buffer->events) {
+        out << sep << "{\"name\":\"" << event.name
+            << "\",\"ph\":\"X\",\"pid\":" << pid << ",\"tid\":" << buffer->tid
+            << ",\"ts\":" << event.start / 1000 << "." << fraction(event.start)
+            << ",\"dur\":" << event.duration / 1000 << "."
+            << fraction(event.duration);
+        if (event.args != 0) {
+          out << ",\"args\":{";
+          for (int i = 0; i != event.args; ++i) {
+            out << (i == 0 ? "" : ",") << "\"" << event.keys[i]
+                << "\":" << event.values[i];
+          }
+          out << "}";
+        }
+        out << "}";
+        sep = ",\n";
+      }
+      if (buffer->dropped != 0) {
+        out << sep << "{\"name\":\"dropped\",\"ph\":\"i\",\"s\":\"t\",\"pid\":"
+            << pid << ",\"tid\":" << buffer->tid << ",\"ts\":0"
+            << ",\"args\":{\"events\":" << buffer->dropped << "}}";
+        sep = ",\n";
+      }
+    }
+    out << "\n],\"displayTimeUnit\":\"ns\"}\n";
+  }
+
+  // Rebuilds the nesting of each thread's scopes from their time ranges and
+  // sums the self time, in microseconds, of every distinct stack.
+  void writeFolded(std::ostream& out) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::map<std::string, uint64_t> stacks;
+    for (const auto& buffer : buffers_) {
+      std::vector<const Event*> events;
+      for (const auto& event : buffer->events) {
+        events.push_back(&event);
+      }
+      std::sort(events.begin(), events.end(),
+                [](const Event* a, const Event* b) {
+                  return a->start != b->start ? a->start < b->start
+                                              : a->duration > b->duration;
+                });
+      std::vector<const Event*> open;
+      std::vector<std::string> paths;
+      std::vector<uint64_t> childTime;
+      auto close = [&]() {
+        const Event* event = open.back();
+        uint64_t self = event->duration - std::min(event->duration,
+                                                   childTime.back());
+        stacks[paths.back()] += self / 1000;
+        open.pop_back();
+        paths.pop_back();
+        childTime.pop_back();
+        if (!childTime.empty()) childTime.back() += event->duration;
+      };
+      for (const Event* event : events) {
+        while (!open.empty() &&
+               open.back()->start + open.back()->duration <= event->start) {
+          close();
+        }
+        paths.push_back(paths.empty() ? std::string(event->name)
+                                      : paths.back() + ";" + event->name);
+        open.push_back(event);
+        childTime.push_back(0);
+      }
+      while (!open.empty()) {
+        close();
+      }
+    }
+    for (const auto& stack : stacks) {
+      if (stack.second != 0) {
+        out << stack.first << " " << stack.second << "\n";
+      }
+    }
+  }
+
+  static std::string fraction(const uint64_t nanos) {
+    std::string digits = std::to_string(nanos % 1000);
+    return std::string(3 - digits.size(), '0') + digits;
+  }
+
+ private:
+  std::atomic<bool> enabled_;
+  uint64_t origin_;
+  std::mutex mutex_;
+  std::vector<std::unique_ptr<ThreadBuffer>> buffers_;
+};
+
+// Times the enclosing block under a static `name`, with up to three integer
+// arguments given up front or added with arg() before the scope ends.
+class TraceScope {
+ public:
+  explicit TraceScope(const char* name) : active_(Tracer::enabled()) {
+    if (active_) begin(name);
+  }
+
+  TraceScope(const char* name, const char* key, const int64_t value)
+      : active_(Tracer::enabled()) {
+    if (active_) {
+      begin(name);
+      arg(key, value);
+    }
+  }
+
+  TraceScope(const char* name, const char* key1, const int64_t value1,
+             const char* key2, const int64_t value2)
+      : active_(Tracer::enabled()) {
+    if (active_) {
+      begin(name);
+      arg(key1, value1);
+      arg(key2, value2);
+    }
+  }
+
+  ~TraceScope() {
+    if (active_) {
+      event_.duration = Tracer::now() - event_.start;
+      Tracer::record(event_);
+    }
+  }
+
+  TraceScope(const TraceScope&) = delete;
+
+  TraceScope& operator=(const TraceScope&) = delete;
+
+  void arg(const char* key, const int64_t value) {
+    if (active_ && event_.args != Tracer::MAX_ARGS) {
+      event_.keys[event_.args] = key;
+      event_.values[event_.args] = value;
+      event_.args += 1;
+    }
+  }
+
+ private:
+  void begin(const char* name) {
+    event_.name = name;
+    event_.args = 0;
+    event_.start = Tracer::now();
+  }
+
+ private:
+  bool active_;
+  Tracer::Event event_;
+};
+
+}  // namespace mydiff
+
+#endif
@@ -0,0 +1,177 @@
+#ifndef _MYDIFF_TREE_DIFF_H_
+#define _MYDIFF_TREE_DIFF_H_
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "mapped-file.h"
+#include "rename-detector.h"
+
+namespace mydiff {
+
+enum TREE_CHANGE { TC_ADDED, TC_DELETED, TC_MODIFIED, TC_RENAMED, TC_COPIED };
+
+// One entry of a tree diff. Renames and copies carry both paths and their
+// similarity score; the other kinds only use the path of their own side.
+struct TreeChange {
+  TREE_CHANGE kind;
+  std::string srcPath;
+  std::string dstPath;
+  int score;
+};
+
+struct TreeDiffOptions {
+  bool findRenames = true;
+  bool findCopies = false;
+  int minScore = 50;
+  size_t threads = 0;
+};
+
+// Compares two directory trees by relative path. Regular files present on
+// both sides are reported when their bytes differ; the files only on one
+// side are then handed to RenameDetector, which turns the similar ones into
+// renames, or copies of any source file when copies are requested.
+class TreeDiff {
+ public:
+  explicit TreeDiff(const TreeDiffOptions& options) : options_(options) {}
+
+  bool diff(const std::string& srcRoot, const std::string& dstRoot,
+            std::vector<TreeChange>& changes) {
+    std::vector<std::string> srcPaths, dstPaths;
+    if (!listTree(srcRoot, srcPaths) || !listTree(dstRoot, dstPaths)) {
+      return false;
+    }
+    std::vector<TreeChange> changesTemp;
+    std::vector<std::string> sources, targets;
+    std::vector<bool> removed;
+    auto src = srcPaths.begin();
+    auto dst = dstPaths.begin();
+    while (src != srcPaths.end() || dst != dstPaths.end()) {
+      if (dst == dstPaths.end() || (src != srcPaths.end() && *src < *dst)) {
+        sources.push_back(*src);
+        removed.push_back(true);
+        ++src;
+      } else if (src == srcPaths.end() || *dst < *src) {
+        targets.push_back(*dst);
+        ++dst;
+      } else {
+        if (!sameContents(srcRoot + "/" + *src, dstRoot + "/" + *dst)) {
+          changesTemp.push_back(TreeChange{TC_MODIFIED, *src, *dst, 0});
+        }
+        if (options_.findCopies) {
+          sources.push_back(*src);
+          removed.push_back(false);
+        }
+        ++src, ++dst;
+      }
+    }
+
+    std::vector<bool> sourceUsed(sources.size(), false);
+    std::vector<bool> targetUsed(targets.size(), false);
+    if (options_.findRenames && !targets.empty()) {
+      std::vector<std::string> sourceFiles, targetFiles;
+      for (const auto& path : sources) {
+        sourceFiles.push_back(srcRoot + "/" + path);
+      }
+      for (const auto& path : targets) {
+        targetFiles.push_back(dstRoot + "/" + path);
+      }
+      std::vector<RenameDetector::Match> matches;
+      RenameDetector detector(options_.minScore, options_.threads);
+      if (!detector.detect(sourceFiles, removed, targetFiles,
+                           options_.findCopies, matches)) {
+        return false;
+      }
+      for (const auto& match : matches) {
+        changesTemp.push_back(
+            TreeChange{match.copy ? TC_COPIED : TC_RENAMED,
+                       sources[match.source], targets[match.target],
+                       match.score});
+        sourceUsed[match.source] = sourceUsed[match.source] || !match.copy;
+        targetUsed[match.target] = true;
+      }
+    }
+    for (size_t i = 0; i != sources.size(); ++i) {
+      if (removed[i] && !sourceUsed[i]) {
+        changesTemp.push_back(TreeChange{TC_DELETED, sources[i], "", 0});
+      }
+    }
+    for (size_t i = 0; i != targets.size(); ++i) {
+      if (!targetUsed[i]) {
+        changesTemp.push_back(TreeChange{TC_ADDED, "", targets[i], 0});
+      }
+    }
+    std::sort(changesTemp.begin(), changesTemp.end(),
+              [](const TreeChange& a, const TreeChange& b) {
+                const std::string& pathA =
+                    a.kind == TC_DELETED ? a.srcPath : a.dstPath;
+                const std::string& pathB =
+                    b.kind == TC_DELETED ? b.srcPath : b.dstPath;
+                return pathA < pathB;
+              });
+    changes.swap(changesTemp);
+    return true;
+  }
+
+  // Regular files under `root`, as sorted paths relative to it. Symbolic
+  // links are not followed.
+  static bool listTree(const std::string& root,
+                       std::vector<std::string>& paths) {
+    std::vector<std::string> pathsTemp;
+    if (!listDir(root, "", pathsTemp)) {
+      return false;
+    }
+    std::sort(pathsTemp.begin(), pathsTemp.end());
+    paths.swap(pathsTemp);
+    return true;
+  }
+
+ private:
+  static bool listDir(const std::string& root, const std::string& prefix,
+                      std::vector<std::string>& paths) {
+    std::string dirPath = prefix.empty() ? root : root + "/" + prefix;
+    DIR* dir = opendir(dirPath.c_str());
+    if (dir == nullptr) {
+      std::cerr << "mydiff: tree: cannot read " << dirPath << std::endl;
+      return false;
+    }
+    bool ok = true;
+    std::vector<std::string> subdirs;
+    for (struct dirent* entry; (entry = readdir(dir)) != nullptr;) {
+      if (std::strcmp(entry->d_name, ".") == 0 ||
+          std::strcmp(entry->d_name, "..") == 0) {
+        continue;
+      }
+      std::string path =
+          prefix.empty() ? entry->d_name : prefix + "/" + entry->d_name;
+      struct stat st;
+      if (lstat((root + "/" + path).c_str(), &st) != 0) {
+        std::cerr << "mydiff: tree: cannot stat " << root << "/" << path
+                  << std::endl;
+        ok = false;
+      } else if (S_ISDIR(st.st_mode)) {
+        subdirs.push_back(path);
+      } else if (S_ISREG(st.st_mode)) {
+        paths.push_back(path);
+      }
+    }
+    closedir(dir);
+    for (const auto& subdir : subdirs) {
+      ok = listDir(root, subdir, paths) && ok;
+    }
+    return ok;
+  }
+
+ private:
+  TreeDiffOptions options_;
+};
+
+}  // namespace mydiff
+
+#endif
@@ -0,0 +1,359 @@
+#ifndef _MYDIFF_UNIX_SERVER_H_
+#define _MYDIFF_UNIX_SERVER_H_
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+#include "thread-pool.h"
+
+namespace mydiff {
+
+// Sends all of [data, data + size) to `fd`; false if the peer went away,
+// which never raises SIGPIPE.
+inline bool sendAll(const int fd, const char* data, size_t size) {
+  for (; size != 0;) {
+    ssize_t n = send(fd, data, size, MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    data += n;
+    size -= n;
+  }
+  return true;
+}
+
+// Buffered std::streambuf over a socket, so a response can be written with
+// the same ostream code as a file and is streamed out in 64 KiB pieces.
+// A peer that went away only makes the stream fail.
+//
+// After beginChunks(), each piece goes out as a chunk `<hex size>\n<bytes>`,
+// so that a body of any content and length can be followed by a status
+// line; endChunks() sends the empty chunk `0\n` and that line.
+class SocketStreamBuf : public std::streambuf {
+  // Room before the buffer for a chunk's size line.
+  enum { BUFFER_SIZE = 64 << 10, HEADER_SIZE = 16 };
+
+ public:
+  explicit SocketStreamBuf(const int fd)
+      : fd_(fd), chunked_(false), buffer_(HEADER_SIZE + BUFFER_SIZE) {
+    setp(buffer_.data() + HEADER_SIZE, buffer_.data() + buffer_.size());
+  }
+
+  ~SocketStreamBuf() { sync(); }
+
+  bool beginChunks() {
+    bool ok = sync() == 0;
+    chunked_ = true;
+    return ok;
+  }
+
+  bool endChunks(const std::string& trailer) {
+    bool ok = sync() == 0;
+    chunked_ = false;
+    std::string last = "0\n" + trailer + "\n";
+    return sendAll(fd_, last.data(), last.size()) && ok;
+  }
+
+ protected:
+  int_type overflow(int_type c) override {
+    if (sync() != 0) {
+      return traits_type::eof();
+    }
+    if (!traits_type::eq_int_type(c, traits_type::eof())) {
+      *pptr() = traits_type::to_char_type(c);
+      pbump(1);
+    }
+    return traits_type::not_eof(c);
+  }
+
+  int sync() override {
+    char* first = pbase();
+    if (chunked_ && first != pptr()) {
+      char header[HEADER_SIZE];
+      int size = snprintf(header, sizeof(header), "%zx\n",
+                          static_cast<size_t>(pptr() - pbase()));
+      first -= size;
+      std::memcpy(first, header, size);
+    }
+    bool ok = sendAll(fd_, first, pptr() - first);
+    setp(buffer_.data() + HEADER_SIZE, buffer_.data() + buffer_.size());
+    return ok ? 0 : -1;
+  }
+
+ private:
+  int fd_;
+  bool chunked_;
+  std::vector<char> buffer_;
+};
+
+// Buffered reads from a socket. A read fails at the end of the stream, on
+// an error, or once the socket's receive timeout, which UnixServer sets on
+// the connections it accepts, runs out.
+class SocketReader {
+  enum { BUFFER_SIZE = 64 << 10 };
+
+ public:
+  explicit SocketReader(const int fd)
+      : fd_(fd), buffer_(BUFFER_SIZE), first_(0), last_(0) {}
+
+  // Reads one '\n' terminated line of at most `maxSize` bytes.
+  bool readLine(std::string& line, const size_t maxSize = 64 << 10) {
+    line.clear();
+    for (;;) {
+      if (first_ == last_ && !fill()) {
+        return false;
+      }
+      const char* begin = buffer_.data() + first_;
+      const char* newline = static_cast<const char*>(
+          std::memchr(begin, '\n', last_ - first_));
+      size_t size = newline != nullptr ? newline - begin : last_ - first_;
+      if (line.size() + size > maxSize) {
+        return false;
+      }
+      line.append(begin, size);
+      first_ += size;
+      if (newline != nullptr) {
+        first_ += 1;
+        return true;
+      }
+    }
+  }
+
+  // Reads a body sent after SocketStreamBuf::beginChunks() into `out`, and
+  // the status line that ends it into `trailer`.
+  bool readChunks(std::ostream& out, std::string& trailer) {
+    for (std::string header;;) {
+      char* end;
+      if (!readLine(header, HEADER_SIZE) || header.empty() ||
+          !std::isxdigit(static_cast<unsigned char>(header[0]))) {
+        return false;
+      }
+      size_t size = std::strtoull(header.c_str(), &end, 16);
+      if (*end != '\0') {
+        return false;
+      }
+      if (size == 0) {
+        return readLine(trailer);
+      }
+      for (; size != 0;) {
+        if (first_ == last_ && !fill()) {
+          return false;
+        }
+        size_t piece = std::min(size, last_ - first_);
+        out.write(buffer_.data() + first_, piece);
+        first_ += piece;
+        size -= piece;
+      }
+    }
+  }
+
+ private:
+  enum { HEADER_SIZE = 16 };
+
+  bool fill() {
+    for (;;) {
+      ssize_t n = read(fd_, buffer_.data(), buffer_.size());
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n <= 0) {
+        return false;
+      }
+      first_ = 0;
+      last_ = n;
+      return true;
+    }
+  }
+
+  int fd_;
+  std::vector<char> buffer_;
+  size_t first_;
+  size_t last_;
+};
+
+// Accepts connections on a Unix domain socket and hands each one to a
+// handler on a worker pool. The handler owns the connection for the length
+// of the call and may use the worker index for per-thread state; the
+// server closes the socket afterwards. A read from a connection fails once
+// the client has sent nothing for RECEIVE_TIMEOUT seconds, so a client
+// that stalls does not hold a worker.
+class UnixServer {
+ public:
+  enum { RECEIVE_TIMEOUT = 10 };
+
+  typedef std::function<void(int fd, size_t worker)> handler_t;
+
+  UnixServer(const std::string& path, const size_t threads)
+      : path_(path),
+        fd_(-1),
+        bound_(false),
+        stopping_(false),
+        pool_(threads) {}
+
+  ~UnixServer() {
+    if (fd_ >= 0) {
+      ::close(fd_);
+    }
+    if (bound_) {
+      unlink(path_.c_str());
+    }
+  }
+
+  UnixServer(const UnixServer&) = delete;
+
+  UnixServer& operator=(const UnixServer&) = delete;
+
+  size_t workers() const { return pool_.size(); }
+
+  // Binds the socket, readable and writable by the owner only. A socket
+  // file left at `path` by a server that is gone is replaced; anything
+  // else there, including a socket something still listens on, is an error.
+  bool listen() {
+    sockaddr_un addr;
+    if (!makeAddress(path_, addr)) {
+      return errorLog("socket path too long: " + path_);
+    }
+    fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd_ < 0) {
+      return errorLog("cannot create socket");
+    }
+    if (!removeStale(path_)) {
+      return false;
+    }
+    if (bind(fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+      return errorLog("cannot bind " + path_ + ": " + strerror(errno));
+    }
+    bound_ = true;
+    // Connections are refused until listen(), so none gets in before the
+    // mode is narrowed.
+    if (chmod(path_.c_str(), S_IRUSR | S_IWUSR) != 0 ||
+        ::listen(fd_, SOMAXCONN) != 0) {
+      return errorLog("cannot listen on " + path_ + ": " + strerror(errno));
+    }
+    return true;
+  }
+
+  // Serves until stop(), then waits for the connections in flight.
+  bool serve(const handler_t& handler) {
+    while (!stopping_) {
+      int client = accept4(fd_, nullptr, nullptr, SOCK_CLOEXEC);
+      if (client < 0) {
+        if (errno == EINTR || errno == ECONNABORTED) continue;
+        if (stopping_) break;
+        pool_.wait();
+        return errorLog(std::string("accept failed: ") + strerror(errno));
+      }
+      timeval timeout = {RECEIVE_TIMEOUT, 0};
+      setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+      pool_.submit([client, &handler](size_t worker) {
+        handler(client, worker);
+        ::close(client);
+      });
+    }
+    pool_.wait();
+    return true;
+  }
+
+  // Makes serve() return. Only touches an atomic and shutdown(), so it may
+  // be called from a handler or a signal handler.
+  void stop() {
+    stopping_ = true;
+    shutdown(fd_, SHUT_RDWR);
+  }
+
+  // Client side: connects to `path`, or returns -1.
+  static int connect(const std::string& path) {
+    sockaddr_un addr;
+    if (!makeAddress(path, addr)) {
+      errorLog("socket path too long: " + path);
+      return -1;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+      errorLog("cannot create socket");
+      return -1;
+    }
+    if (::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+      errorLog("cannot connect to " + path + ": " + strerror(errno));
+      ::close(fd);
+      return -1;
+    }
+    return fd;
+  }
+
+ private:
+  // Unlinks `path` if it is a socket no server accepts on any more.
+  static bool removeStale(const std::string& path) {
+    struct stat st;
+    if (lstat(path.c_str(), &st) != 0) {
+      return errno == ENOENT ||
+             errorLog("cannot stat " + path + ": " + strerror(errno));
+    }
+    if (!S_ISSOCK(st.st_mode)) {
+      return errorLog("refusing to replace " + path + ", not a socket");
+    }
+    sockaddr_un addr;
+    makeAddress(path, addr);
+    int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (probe < 0) {
+      return errorLog("cannot create socket");
+    }
+    int ret =
+        ::connect(probe, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+    int error = errno;
+    ::close(probe);
+    if (ret == 0) {
+      return errorLog(path + " is in use by a running server");
+    }
+    if (error != ECONNREFUSED) {
+      return errorLog("cannot probe " + path + ": " + strerror(error));
+    }
+    if (unlink(path.c_str()) != 0) {
+      return errorLog("cannot remove " + path + ": " + strerror(errno));
+    }
+    return true;
+  }
+
+  static bool makeAddress(const std::string& path, sockaddr_un& addr) {
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+      return false;
+    }
+    std::memcpy(addr.sun_path, path.data(), path.size());
+    return true;
+  }
+
+  static bool errorLog(const std::string& logInfo) {
+    std::cerr << "mydiff: server: " << logInfo << std::endl;
+    return false;
+  }
+
+ private:
+  std::string path_;
+  int fd_;
+  bool bound_;
+  std::atomic<bool> stopping_;
+  ThreadPool pool_;
+};
+
+}  // namespace mydiff
+
+#endif
@@ -0,0 +1,142 @@
+#ifndef _DBLISP_DBLISP_TOKENIZER_H_
+#define _DBLISP_DBLISP_TOKENIZER_H_
+
+#include <cstring>
+#include <string>
+
+namespace dblisp {
+
+enum WordType { LEFT_PARENTHESIS, RIGHT_PARENTHESIS, STRING_VALUE, VARIABLE };
+
+// A word of dblisp text. `data` points into the tokenized buffer, or for a
+// string with escaped quotes into a buffer of the tokenizer that the next
+// word reuses.
+struct DbLispToken {
+  WordType type;
+  const char* data;
+  size_t size;
+};
+
+// Splits dblisp text into words without copying it. Only a string holding
+// `\"` is copied, to drop its backslashes, into a buffer reused from one
+// such string to the next. The rules are those the parser
+// has always applied line by line:
+//
+//   - `;` outside a string starts a comment running to the end of the line
+//   - a string runs from `"` to the next `"` not preceded by a backslash,
+//     across lines, and keeps every other byte as is
+//   - a variable is any other run of bytes up to a blank or `)`, so `(`,
+//     `;` and `"` inside it are part of the name
+class DbLispTokenizer {
+ public:
+  DbLispTokenizer(const char* data, const size_t size)
+      : first_(data), current_(data), last_(data + size), open_(nullptr) {}
+
+  DbLispTokenizer(const DbLispTokenizer&) = delete;
+
+  DbLispTokenizer& operator=(const DbLispTokenizer&) = delete;
+
+  // False at the end of the input or at a string left open, which
+  // unclosed() tells apart.
+  bool next(DbLispToken& token) {
+    for (; current_ != last_; ++current_) {
+      switch (*current_) {
+        case '(':
+          token = DbLispToken{LEFT_PARENTHESIS, current_++, 1};
+          return true;
+        case ')':
+          token = DbLispToken{RIGHT_PARENTHESIS, current_++, 1};
+          return true;
+        case ';':
+          current_ = static_cast<const char*>(
+              std::memchr(current_, '\n', last_ - current_));
+          if (current_ == nullptr) {
+            current_ = last_;
+            return false;
+          }
+          break;
+        case '"':
+          return quoted(token);
+        default:
+          if (!isBlank(*current_)) {
+            const char* first = current_;
+            for (; current_ != last_ && !isBlank(*current_) &&
+                   *current_ != ')';
+                 ++current_) {
+            }
+            token = DbLispToken{VARIABLE, first,
+                                static_cast<size_t>(current_ - first)};
+            return true;
+          }
+      }
+    }
+    return false;
+  }
+
+  bool unclosed() const { return open_ != nullptr; }
+
+  // 0-based line and column of the quote of the string left open.
+  size_t openLineIndex() const {
+    size_t line = 0;
+    for (const char* pos = first_; pos != open_; ++pos) {
+      line += *pos == '\n';
+    }
+    return line;
+  }
+
+  size_t openIndex() const {
+    const char* pos = open_;
+    for (; pos != first_ && *(pos - 1) != '\n'; --pos) {
+    }
+    return open_ - pos;
+  }
+
+ private:
+  bool quoted(DbLispToken& token) {
+    const char* first = current_ + 1;
+    bool escaped = false;
+    for (const char* pos = first;; ++pos) {
+      pos = static_cast<const char*>(std::memchr(pos, '"', last_ - pos));
+      if (pos == nullptr) {
+        open_ = current_;
+        current_ = last_;
+        return false;
+      }
+      if (*(pos - 1) != '\\') {
+        token = DbLispToken{STRING_VALUE, first,
+                            static_cast<size_t>(pos - first)};
+        current_ = pos + 1;
+        break;
+      }
+      escaped = true;
+    }
+    if (escaped) {
+      unescaped_.clear();
+      for (const char* pos = first; pos != first + token.size; ++pos) {
+        if (*pos == '\\' && *(pos + 1) == '"') {
+          continue;
+        }
+        unescaped_.push_back(*pos);
+      }
+      token.data = unescaped_.data();
+      token.size = unescaped_.size();
+    }
+    return true;
+  }
+
+  static bool isBlank(const char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' ||
+           c == '\v';
+  }
+
+ private:
+  const char* first_;
+  const char* current_;
+  const char* last_;
+  const char* open_;
+  std::string unescaped_;
+};
+
+}  // namespace dblisp
+
+#endif
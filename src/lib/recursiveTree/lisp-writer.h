@@ -0,0 +1,206 @@
+#ifndef _DBLISP_LISP_WRITER_H_
+#define _DBLISP_LISP_WRITER_H_
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace dblisp {
+
+// LISP_PRETTY is the layout formatLisp() has always produced, a child per
+// line under its parent's key; LISP_COMPACT is the same text on one line.
+enum LISP_FORMAT { LISP_PRETTY, LISP_COMPACT };
+
+// Sinks of RecTree::writeLisp(). A sink is any type with
+//
+//   bool write(const char* data, size_t size);
+//
+// returning false on an error, after which nothing more is written to it.
+
+// Appends to a string; formatLisp() writes through it.
+class StringSink {
+ public:
+  explicit StringSink(std::string& str) : str_(str) {}
+
+  bool write(const char* data, const size_t size) {
+    str_.append(data, size);
+    return true;
+  }
+
+ private:
+  std::string& str_;
+};
+
+class StreamSink {
+ public:
+  explicit StreamSink(std::ostream& outStream) : outStream_(outStream) {}
+
+  bool write(const char* data, const size_t size) {
+    return static_cast<bool>(outStream_.write(data, size));
+  }
+
+ private:
+  std::ostream& outStream_;
+};
+
+// Writes to a FILE, which does its own buffering.
+class FileSink {
+ public:
+  explicit FileSink(FILE* file) : file_(file) {}
+
+  bool write(const char* data, const size_t size) {
+    return std::fwrite(data, 1, size, file_) == size;
+  }
+
+ private:
+  FILE* file_;
+};
+
+// Writes to a file descriptor through a fixed buffer. The last bytes stay
+// in the buffer until flush(), which the destructor calls too but without
+// a way to report an error.
+class FdSink {
+  enum { BUFFER_SIZE = 64 * 1024 };
+
+ public:
+  explicit FdSink(const int fd) : fd_(fd), buffer_(BUFFER_SIZE), size_(0) {}
+
+  ~FdSink() { flush(); }
+
+  FdSink(const FdSink&) = delete;
+
+  FdSink& operator=(const FdSink&) = delete;
+
+  bool write(const char* data, size_t size) {
+    if (size_ + size > buffer_.size()) {
+      if (!flush()) {
+        return false;
+      }
+      if (size >= buffer_.size()) {
+        return writeAll(data, size);
+      }
+    }
+    std::memcpy(buffer_.data() + size_, data, size);
+    size_ += size;
+    return true;
+  }
+
+  bool flush() {
+    size_t size = size_;
+    size_ = 0;
+    return writeAll(buffer_.data(), size);
+  }
+
+ private:
+  bool writeAll(const char* data, size_t size) {
+    while (size != 0) {
+      ssize_t written = ::write(fd_, data, size);
+      if (written <= 0) {
+        return false;
+      }
+      data += written;
+      size -= written;
+    }
+    return true;
+  }
+
+ private:
+  int fd_;
+  std::vector<char> buffer_;
+  size_t size_;
+};
+
+// Collects the output in chunks of a fixed capacity, so that a large tree
+// is held without one contiguous string or the copies of its growth.
+class ChunkSink {
+ public:
+  explicit ChunkSink(const size_t chunkSize = 64 * 1024)
+      : chunkSize_(chunkSize) {}
+
+  bool write(const char* data, size_t size) {
+    while (size != 0) {
+      if (chunks_.empty() || chunks_.back().size() == chunkSize_) {
+        chunks_.emplace_back();
+        chunks_.back().reserve(chunkSize_);
+      }
+      std::string& chunk = chunks_.back();
+      size_t part = std::min(size, chunkSize_ - chunk.size());
+      chunk.append(data, part);
+      data += part;
+      size -= part;
+    }
+    return true;
+  }
+
+  const std::vector<std::string>& chunks() const { return chunks_; }
+
+ private:
+  size_t chunkSize_;
+  std::vector<std::string> chunks_;
+};
+
+// The pieces RecTree::writeLisp() is written with. Writes nothing more
+// once the sink has failed, which ok() then tells.
+template <typename Sink>
+class LispWriter {
+ public:
+  LispWriter(Sink& sink, const LISP_FORMAT format)
+      : sink_(sink), pretty_(format == LISP_PRETTY), ok_(true) {}
+
+  bool ok() const { return ok_; }
+
+  void put(const char c) { put(&c, 1); }
+
+  void put(const char* data, const size_t size) {
+    ok_ = ok_ && sink_.write(data, size);
+  }
+
+  // Writes `str` in quotes, with a backslash before each quote inside it,
+  // and returns the size of what it wrote.
+  size_t quoted(const std::string& str) {
+    size_t ret = str.size() + 2;
+    const char* first = str.data();
+    const char* last = first + str.size();
+    put('"');
+    for (const char* pos; (pos = static_cast<const char*>(std::memchr(
+                               first, '"', last - first))) != nullptr;
+         first = pos + 1) {
+      put(first, pos - first);
+      put("\\\"", 2);
+      ++ret;
+    }
+    put(first, last - first);
+    put('"');
+    return ret;
+  }
+
+  // A line break and `count` spaces when pretty, otherwise `separator`
+  // alone if there is one.
+  void newline(const size_t count, const char* separator) {
+    if (!pretty_) {
+      put(separator, std::strlen(separator));
+      return;
+    }
+    static const char spaces[] = "                                ";
+    put('\n');
+    for (size_t left = count; left != 0;) {
+      size_t part = std::min(left, sizeof(spaces) - 1);
+      put(spaces, part);
+      left -= part;
+    }
+  }
+
+ private:
+  Sink& sink_;
+  bool pretty_;
+  bool ok_;
+};
+
+}  // namespace dblisp
+
+#endif
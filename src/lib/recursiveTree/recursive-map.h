@@ -1,12 +1,23 @@
 #ifndef _DBLISP_RECURSIVE_MAP_H_
 #define _DBLISP_RECURSIVE_MAP_H_
 
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <iterator>
+#include <limits>
 #include <map>
 #include <memory>
+#include <stdexcept>
 #include <string>
 #include <vector>
 
+#include "lisp-writer.h"
+#include "tree-arena.h"
+
 namespace dblisp {
 class RecTree;
 
@@ -15,6 +26,7 @@ using recursive_map = RecTree;
 class KeyType {
   using pointer = std::shared_ptr<std::string>;
   friend class RecTree;
+  friend class ChildMap;
   friend std::ostream& operator<<(std::ostream& outStream, const KeyType& key);
   friend bool operator==(const KeyType& left, const KeyType& right);
   friend bool operator<(const KeyType& left, const KeyType& right);
@@ -24,6 +36,13 @@ class KeyType {
 
   explicit KeyType(const std::string& key) : keyPtr_(createPointer(key)) {}
 
+  // Keeps the string and its reference count in `arena` when there is one.
+  KeyType(std::string key, const std::shared_ptr<TreeArena>& arena)
+      : keyPtr_(arena == nullptr ? createPointer(std::move(key))
+                                 : std::allocate_shared<std::string>(
+                                       TreeAllocator<std::string>(arena),
+                                       std::move(key))) {}
+
   KeyType(const KeyType& x) : keyPtr_(x.keyPtr_) {}
 
   void swap(KeyType& x) noexcept { std::swap(keyPtr_, x.keyPtr_); }
@@ -39,16 +58,18 @@ class KeyType {
 
   std::string toString() const { return *keyPtr_; }
 
+  const std::string& str() const { return *keyPtr_; }
+
   void clear() { freePointer(keyPtr_); }
 
   bool isNull() const { return keyPtr_.get() == nullptr; }
 
  private:
-  pointer createPointer(const std::string& key) {
-    return std::make_shared<std::string>(key);
+  pointer createPointer(std::string key) {
+    return std::make_shared<std::string>(std::move(key));
   }
 
-  void freePointer(pointer ptr) { keyPtr_.reset(); }
+  void freePointer(pointer) { keyPtr_.reset(); }
 
   const std::string& constRefer() const { return *keyPtr_; }
 
@@ -85,52 +106,235 @@ inline bool operator<=(const KeyType& left, const KeyType& right) {
   return (!(left > right));
 }
 
+// A value of a RecTree node. The first numeric access parses the string
+// and keeps the number, which later accesses of any numeric type read. A
+// string that is not wholly one number is parsed by std::sto* on each call
+// and throws as it always has. The overloads with an output parameter never
+// throw, and return false unless the string is a number fitting the type.
 class ValType {
   friend class RecTree;
+  friend class TreeSnapshot;
 
   friend std::ostream& operator<<(std::ostream& outStream,
                                   const ValType& value);
 
+  // What the first parse found, and so what number_ holds. "-0" is an
+  // integer of its own, as the integer 0 would lose the sign of the double.
+  enum PARSED {
+    PARSED_NOT_YET,
+    PARSED_INTEGER,
+    PARSED_MINUS_ZERO,
+    PARSED_FLOATING,
+    PARSED_NONE
+  };
+
  public:
-  explicit ValType(const std::string& valStr) : valStr_(valStr) {}
+  explicit ValType(const std::string& valStr)
+      : valStr_(valStr), parsed_(PARSED_NOT_YET), number_(0) {}
+
+  explicit ValType(std::string&& valStr)
+      : valStr_(std::move(valStr)), parsed_(PARSED_NOT_YET), number_(0) {}
 
-  ValType(ValType&& x) : valStr_(std::move(x.valStr_)) {}
+  ValType(ValType&& x)
+      : valStr_(std::move(x.valStr_)),
+        parsed_(x.parsed_.load(std::memory_order_acquire)),
+        number_(x.number_.load(std::memory_order_relaxed)) {
+    x.parsed_.store(PARSED_NOT_YET, std::memory_order_relaxed);
+  }
 
-  ValType(const ValType& x) : valStr_(x.valStr_) {}
+  ValType(const ValType& x)
+      : valStr_(x.valStr_),
+        parsed_(x.parsed_.load(std::memory_order_acquire)),
+        number_(x.number_.load(std::memory_order_relaxed)) {}
 
   ValType& operator=(ValType x) {
     swap(x);
     return *this;
   }
 
-  void swap(ValType& x) noexcept { valStr_.swap(x.valStr_); }
+  void swap(ValType& x) noexcept {
+    valStr_.swap(x.valStr_);
+    uint8_t parsed = parsed_.load(std::memory_order_relaxed);
+    parsed_.store(x.parsed_.load(std::memory_order_relaxed),
+                  std::memory_order_relaxed);
+    x.parsed_.store(parsed, std::memory_order_relaxed);
+    uint64_t number = number_.load(std::memory_order_relaxed);
+    number_.store(x.number_.load(std::memory_order_relaxed),
+                  std::memory_order_relaxed);
+    x.number_.store(number, std::memory_order_relaxed);
+  }
 
   operator std::string() const { return asString(); }
 
   bool asBool() const { return valStr_ != "false"; }
 
-  int asInt() const { return std::stoi(valStr_); }
+  int asInt() const {
+    int value;
+    return integer(value) ? value : std::stoi(valStr_);
+  }
 
-  long int asLInt() const { return std::stol(valStr_); }
+  long int asLInt() const {
+    long int value;
+    return integer(value) ? value : std::stol(valStr_);
+  }
 
-  long long int asLLInt() const { return std::stoll(valStr_); }
+  long long int asLLInt() const {
+    long long int value;
+    return integer(value) ? value : std::stoll(valStr_);
+  }
 
-  unsigned int asUInt() const { return std::stoul(valStr_); }
+  unsigned int asUInt() const {
+    unsigned long int value;
+    return integer(value) ? value : std::stoul(valStr_);
+  }
 
-  unsigned long long int asULLInt() const { return std::stoull(valStr_); }
+  unsigned long long int asULLInt() const {
+    unsigned long long int value;
+    return integer(value) ? value : std::stoull(valStr_);
+  }
 
   std::string asString() const { return valStr_; }
 
+  const std::string& str() const { return valStr_; }
+
   char asChar() const { return valStr_.front(); }
 
-  float asFloat() const { return std::stof(valStr_); }
+  float asFloat() const {
+    return parse() == PARSED_INTEGER ? static_cast<float>(intNumber())
+                                     : std::stof(valStr_);
+  }
+
+  double asDouble() const {
+    double value;
+    return floating(value) ? value : std::stod(valStr_);
+  }
+
+  long double asLDouble() const {
+    return parse() == PARSED_INTEGER ? static_cast<long double>(intNumber())
+                                     : std::stold(valStr_);
+  }
+
+  bool asInt(int& value) const { return integer(value); }
+
+  bool asLInt(long int& value) const { return integer(value); }
+
+  bool asLLInt(long long int& value) const { return integer(value); }
+
+  bool asUInt(unsigned int& value) const {
+    return integer(value) || unsignedInteger(value);
+  }
+
+  bool asULLInt(unsigned long long int& value) const {
+    return integer(value) || unsignedInteger(value);
+  }
+
+  bool asDouble(double& value) const { return floating(value); }
+
+ private:
+  // The kept integer if it fits in T. Integers parse as long long int, so
+  // unsigned values above its range are left to unsignedInteger().
+  template <typename T>
+  bool integer(T& value) const {
+    PARSED parsed = parse();
+    if (parsed != PARSED_INTEGER && parsed != PARSED_MINUS_ZERO) {
+      return false;
+    }
+    long long int number = intNumber();
+    if (std::numeric_limits<T>::is_signed
+            ? number < static_cast<long long int>(
+                           std::numeric_limits<T>::min()) ||
+                  number > static_cast<long long int>(
+                               std::numeric_limits<T>::max())
+            : number < 0 || static_cast<unsigned long long int>(number) >
+                                std::numeric_limits<T>::max()) {
+      return false;
+    }
+    value = static_cast<T>(number);
+    return true;
+  }
+
+  template <typename T>
+  bool unsignedInteger(T& value) const {
+    const char* first = valStr_.c_str();
+    if (valStr_.find('-') != std::string::npos) {
+      return false;
+    }
+    char* last;
+    int savedErrno = errno;
+    errno = 0;
+    unsigned long long int number = std::strtoull(first, &last, 10);
+    bool ok = last != first && last == first + valStr_.size() &&
+              errno == 0 && number <= std::numeric_limits<T>::max();
+    errno = savedErrno;
+    if (ok) {
+      value = static_cast<T>(number);
+    }
+    return ok;
+  }
 
-  double asDouble() const { return std::stod(valStr_); }
+  bool floating(double& value) const {
+    switch (parse()) {
+      case PARSED_INTEGER:
+        value = static_cast<double>(intNumber());
+        return true;
+      case PARSED_MINUS_ZERO:
+        value = -0.0;
+        return true;
+      case PARSED_FLOATING: {
+        uint64_t number = number_.load(std::memory_order_relaxed);
+        std::memcpy(&value, &number, sizeof(value));
+        return true;
+      }
+      default:
+        return false;
+    }
+  }
+
+  long long int intNumber() const {
+    return static_cast<long long int>(
+        number_.load(std::memory_order_relaxed));
+  }
 
-  long double asLDouble() const { return std::stold(valStr_); }
+  // Parses valStr_ on the first call only. Concurrent first calls parse
+  // alike and store the same number, so readers need no lock.
+  PARSED parse() const {
+    PARSED parsed =
+        static_cast<PARSED>(parsed_.load(std::memory_order_acquire));
+    if (parsed != PARSED_NOT_YET) {
+      return parsed;
+    }
+    const char* first = valStr_.c_str();
+    const char* end = first + valStr_.size();
+    char* last;
+    uint64_t number = 0;
+    int savedErrno = errno;
+    errno = 0;
+    long long int integer = std::strtoll(first, &last, 10);
+    if (last != first && last == end && errno == 0) {
+      parsed = integer == 0 && valStr_.find('-') != std::string::npos
+                   ? PARSED_MINUS_ZERO
+                   : PARSED_INTEGER;
+      number = static_cast<uint64_t>(integer);
+    } else {
+      errno = 0;
+      double floating = std::strtod(first, &last);
+      if (last != first && last == end && errno == 0) {
+        parsed = PARSED_FLOATING;
+        std::memcpy(&number, &floating, sizeof(number));
+      } else {
+        parsed = PARSED_NONE;
+      }
+    }
+    errno = savedErrno;
+    number_.store(number, std::memory_order_relaxed);
+    parsed_.store(parsed, std::memory_order_release);
+    return parsed;
+  }
 
  private:
   std::string valStr_;
+  mutable std::atomic<uint8_t> parsed_;
+  mutable std::atomic<uint64_t> number_;
 };
 
 inline std::ostream& operator<<(std::ostream& outStream, const ValType& value) {
@@ -138,8 +342,28 @@ inline std::ostream& operator<<(std::ostream& outStream, const ValType& value) {
   return outStream;
 }
 
+// Child map of a RecTree, allocated from the tree's arena if it has one.
+using rectree_map =
+    std::map<KeyType, RecTree*, std::less<KeyType>,
+             TreeAllocator<std::pair<const KeyType, RecTree*>>>;
+
+// How a tree stores the children of its nodes, chosen once per tree.
+enum CHILD_STORAGE { MAP_CHILDREN, FLAT_CHILDREN };
+
+// Entry of a flat child container. `prefix` holds the first eight bytes of
+// the key, big-endian and zero padded, so that most comparisons of a lookup
+// stay inside the entry.
+struct FlatChild {
+  uint64_t prefix;
+  KeyType first;
+  RecTree* second;
+};
+
+using flat_children = std::vector<FlatChild, TreeAllocator<FlatChild>>;
+
 struct RecTree_const_iterator {
   friend class RecTree;
+  friend class ChildMap;
 
  public:
   typedef std::bidirectional_iterator_tag iterator_category;
@@ -148,35 +372,51 @@ struct RecTree_const_iterator {
   typedef const value_type* pointer;
   typedef ptrdiff_t difference_type;
 
-  typedef typename std::map<KeyType, RecTree*>::iterator node_type;
+  typedef typename rectree_map::iterator node_type;
+  typedef FlatChild* flat_type;
   typedef RecTree_const_iterator self;
 
-  RecTree_const_iterator() = default;
+  RecTree_const_iterator() : node_(), flat_(nullptr) {}
 
-  RecTree_const_iterator(const node_type& node) : node_(node) {}
+  RecTree_const_iterator(const node_type& node)
+      : node_(node), flat_(nullptr) {}
 
-  RecTree_const_iterator(const self& x) : node_(x.node_) {}
+  explicit RecTree_const_iterator(const flat_type flat)
+      : node_(), flat_(flat) {}
 
-  bool operator==(const self& x) const { return node_ == x.node_; }
+  RecTree_const_iterator(const self& x) : node_(x.node_), flat_(x.flat_) {}
+
+  bool operator==(const self& x) const {
+    return node_ == x.node_ && flat_ == x.flat_;
+  }
 
   bool operator!=(const self& x) const { return (!(operator==(x))); }
 
   self& operator=(const self& x) {
     node_ = x.node_;
+    flat_ = x.flat_;
     return (*this);
   }
 
-  reference operator*() const { return *node_->second; }
+  reference operator*() const { return *link(); }
 
   pointer operator->() const { return (&(operator*())); }
 
   self& operator--() {
-    --node_;
+    if (flat_ != nullptr) {
+      --flat_;
+    } else {
+      --node_;
+    }
     return *this;
   }
 
   self& operator++() {
-    ++node_;
+    if (flat_ != nullptr) {
+      ++flat_;
+    } else {
+      ++node_;
+    }
     return *this;
   }
 
@@ -192,8 +432,20 @@ struct RecTree_const_iterator {
     return (temp);
   }
 
+ protected:
+  RecTree* link() const { return linkRef(); }
+
+  RecTree*& linkRef() const {
+    return flat_ != nullptr ? flat_->second : node_->second;
+  }
+
+  const KeyType& keyRef() const {
+    return flat_ != nullptr ? flat_->first : node_->first;
+  }
+
  protected:
   node_type node_;
+  flat_type flat_;
 };
 
 struct RecTree_iterator : public RecTree_const_iterator {
@@ -206,30 +458,33 @@ struct RecTree_iterator : public RecTree_const_iterator {
   typedef ptrdiff_t difference_type;
 
   typedef typename base_iterator::node_type node_type;
+  typedef typename base_iterator::flat_type flat_type;
   typedef RecTree_iterator self;
 
   RecTree_iterator() = default;
 
   RecTree_iterator(const node_type& node) : base_iterator(node) {}
 
-  RecTree_iterator(const self& x) : base_iterator(x.node_) {}
+  explicit RecTree_iterator(const flat_type flat) : base_iterator(flat) {}
+
+  RecTree_iterator(const self& x) : base_iterator(x) {}
 
   self& operator=(const self& x) {
-    this->node_ = x.node_;
+    base_iterator::operator=(x);
     return *this;
   }
 
-  reference operator*() const { return (*this->node_->second); }
+  reference operator*() const { return *this->link(); }
 
   pointer operator->() const { return (&(operator*())); }
 
   self& operator--() {
-    --this->node_;
+    base_iterator::operator--();
     return *this;
   }
 
   self& operator++() {
-    ++this->node_;
+    base_iterator::operator++();
     return *this;
   }
 
@@ -246,74 +501,399 @@ struct RecTree_iterator : public RecTree_const_iterator {
   }
 };
 
+// Counts the changes that may move, free or share the nodes of any tree,
+// so that a KeyPath can tell whether the node it found last is still
+// there. Threads that write trees only ever use it through them, with
+// whatever ordering they already have, so the counter is relaxed.
+class TreeGeneration {
+ public:
+  static uint64_t current() {
+    return counter().load(std::memory_order_relaxed);
+  }
+
+  static void bump() { counter().fetch_add(1, std::memory_order_relaxed); }
+
+ private:
+  static std::atomic<uint64_t>& counter() {
+    static std::atomic<uint64_t> value(0);
+    return value;
+  }
+};
+
+// Children of a RecTree node, in key order either way: a rectree_map, or a
+// flat vector of FlatChild entries sorted by key. The flat form finds a key
+// by binary search over contiguous entries and iterates by a linear scan,
+// several times faster than walking the red-black tree. Inserting or
+// erasing a flat child moves the entries after it, so as with any vector it
+// costs O(n) and invalidates iterators, though never references to the
+// child trees, which stay where they are.
+//
+// A map is shared by the copies of a tree, and is then never changed,
+// until each but one has let go of it; see RecTree::detach(). Sharing,
+// letting go of or erasing from a map bumps the TreeGeneration.
+class ChildMap {
+ public:
+  typedef RecTree_iterator iterator;
+
+  ChildMap(const CHILD_STORAGE storage,
+           const std::shared_ptr<TreeArena>& arena)
+      : storage_(storage), refs_(1) {
+    if (storage_ == FLAT_CHILDREN) {
+      new (&flat_) flat_children(TreeAllocator<FlatChild>(arena));
+    } else {
+      new (&map_) rectree_map(std::less<KeyType>(),
+                              TreeAllocator<rectree_map::value_type>(arena));
+    }
+  }
+
+  ~ChildMap() {
+    if (storage_ == FLAT_CHILDREN) {
+      flat_.~flat_children();
+    } else {
+      map_.~rectree_map();
+    }
+  }
+
+  ChildMap(const ChildMap&) = delete;
+
+  ChildMap& operator=(const ChildMap&) = delete;
+
+  iterator begin() {
+    return isFlat() ? iterator(flat_.data()) : iterator(map_.begin());
+  }
+
+  iterator end() {
+    return isFlat() ? iterator(flat_.data() + flat_.size())
+                    : iterator(map_.end());
+  }
+
+  size_t size() const { return isFlat() ? flat_.size() : map_.size(); }
+
+  void acquire() {
+    TreeGeneration::bump();
+    refs_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  // True for the last tree to let go of the map, which then frees it.
+  bool release() {
+    TreeGeneration::bump();
+    return refs_.fetch_sub(1, std::memory_order_acq_rel) == 1;
+  }
+
+  bool shared() const { return refs_.load(std::memory_order_acquire) != 1; }
+
+  // Looks up [data, data + size) without allocating. std::map has no
+  // heterogeneous lookup before C++14, so the map form probes with a key of
+  // this thread whose string buffer is reused from one call to the next.
+  iterator find(const char* data, const size_t size) {
+    if (!isFlat()) {
+      static thread_local KeyType probe;
+      probe.keyPtr_->assign(data, size);
+      return map_.find(probe);
+    }
+    FlatChild* pos = lowerBound(data, size);
+    return pos != flat_.data() + flat_.size() &&
+                   pos->first.constRefer().compare(0, std::string::npos,
+                                                   data, size) == 0
+               ? iterator(pos)
+               : end();
+  }
+
+  // Throws std::out_of_range for a missing key, as std::map::at() does.
+  RecTree* at(const char* data, const size_t size) {
+    iterator pos = find(data, size);
+    if (pos == end()) {
+      throw std::out_of_range("dblisp::ChildMap::at");
+    }
+    return pos.link();
+  }
+
+  std::pair<iterator, bool> emplace(const KeyType& key, RecTree* child) {
+    if (!isFlat()) {
+      auto prIB = map_.emplace(key, child);
+      return {prIB.first, prIB.second};
+    }
+    const std::string& str = key.constRefer();
+    FlatChild* pos = lowerBound(str.data(), str.size());
+    size_t index = pos - flat_.data();
+    if (index != flat_.size() && pos->first.constRefer() == str) {
+      return {iterator(pos), false};
+    }
+    flat_.insert(flat_.begin() + index,
+                 FlatChild{prefixOf(str.data(), str.size()), key, child});
+    return {iterator(flat_.data() + index), true};
+  }
+
+  // Adds a child whose key follows every key of the map, as when copying
+  // another map in order, without searching for its place.
+  void append(const KeyType& key, RecTree* child) {
+    if (!isFlat()) {
+      map_.emplace_hint(map_.end(), key, child);
+      return;
+    }
+    const std::string& str = key.constRefer();
+    flat_.push_back(FlatChild{prefixOf(str.data(), str.size()), key, child});
+  }
+
+  iterator erase(const RecTree_const_iterator& pos) {
+    TreeGeneration::bump();
+    if (!isFlat()) {
+      return map_.erase(pos.node_);
+    }
+    size_t index = pos.flat_ - flat_.data();
+    flat_.erase(flat_.begin() + index);
+    return iterator(flat_.data() + index);
+  }
+
+  iterator erase(const RecTree_const_iterator& first,
+                 const RecTree_const_iterator& last) {
+    TreeGeneration::bump();
+    if (!isFlat()) {
+      return map_.erase(first.node_, last.node_);
+    }
+    size_t index = first.flat_ - flat_.data();
+    flat_.erase(flat_.begin() + index,
+                flat_.begin() + (last.flat_ - flat_.data()));
+    return iterator(flat_.data() + index);
+  }
+
+  void clear() {
+    if (isFlat()) {
+      flat_.clear();
+    } else {
+      map_.clear();
+    }
+  }
+
+ private:
+  bool isFlat() const { return storage_ == FLAT_CHILDREN; }
+
+  static uint64_t prefixOf(const char* data, const size_t size) {
+    uint64_t prefix = 0;
+    for (size_t i = 0; i != 8; ++i) {
+      prefix = (prefix << 8) |
+               (i < size ? static_cast<unsigned char>(data[i]) : 0);
+    }
+    return prefix;
+  }
+
+  // First entry whose key is not less than [data, data + size).
+  FlatChild* lowerBound(const char* data, const size_t size) {
+    uint64_t prefix = prefixOf(data, size);
+    FlatChild* first = flat_.data();
+    for (size_t count = flat_.size(); count != 0;) {
+      size_t half = count / 2;
+      const FlatChild& entry = first[half];
+      bool less = entry.prefix != prefix
+                      ? entry.prefix < prefix
+                      : entry.first.constRefer().compare(
+                            0, std::string::npos, data, size) < 0;
+      if (less) {
+        first += half + 1;
+        count -= half + 1;
+      } else {
+        count = half;
+      }
+    }
+    return first;
+  }
+
+ private:
+  CHILD_STORAGE storage_;
+  std::atomic<size_t> refs_;
+  union {
+    rectree_map map_;
+    flat_children flat_;
+  };
+};
+
+// Key path into a RecTree, split into its keys once so that a deep lookup
+// costs one allocation-free child search per segment and no parsing. It
+// remembers the node it found last and the tree it started from, and
+// returns that node again in a few loads while the TreeGeneration is
+// unchanged. As it writes that memo even on const lookups, one KeyPath is
+// used by one thread at a time; copies are independent.
+class KeyPath {
+  friend class RecTree;
+
+ public:
+  KeyPath() = default;
+
+  explicit KeyPath(std::vector<std::string> keys) : keys_(std::move(keys)) {}
+
+  // Every separator separates, so "a//b" has an empty middle key; only the
+  // empty string is the empty path.
+  KeyPath(const std::string& path, const char separator) {
+    if (path.empty()) {
+      return;
+    }
+    for (size_t first = 0, last = 0; first <= path.size(); first = last + 1) {
+      last = path.find(separator, first);
+      if (last == std::string::npos) {
+        last = path.size();
+      }
+      keys_.emplace_back(path, first, last - first);
+    }
+  }
+
+  const std::vector<std::string>& keys() const { return keys_; }
+
+  size_t size() const { return keys_.size(); }
+
+ private:
+  // The node found last from `root`, or null. One found by a const lookup
+  // may lie in children shared with a copy, so it is not handed out for
+  // writing.
+  const RecTree* remembered(const RecTree* root, const bool writable) const {
+    return root == root_ && (writable_ || !writable) &&
+                   generation_ == TreeGeneration::current()
+               ? node_
+               : nullptr;
+  }
+
+  void remember(const RecTree* root, const RecTree* node,
+                const bool writable) const {
+    root_ = root;
+    node_ = node;
+    writable_ = writable;
+    generation_ = TreeGeneration::current();
+  }
+
+  std::vector<std::string> keys_;
+  mutable const RecTree* root_ = nullptr;
+  mutable const RecTree* node_ = nullptr;
+  mutable uint64_t generation_ = 0;
+  mutable bool writable_ = false;
+};
+
 class DbLispParser;
+class TreeSnapshot;
 
 class RecTree {
   friend class DbLispParser;
+  friend class TreeArena;
+  friend class TreeSnapshot;
 
  public:
   using key_type = KeyType;
   using link_type = RecTree*;
   enum VALUE_TYPE { VALUE, VALUE_VECTOR, RECTREE, INITAL };
+  // A single value is kept as a vector of one, so that valueVector() const
+  // never has to convert it.
   union value_type {
-    ValType* value_;
     std::vector<ValType>* valueVec_;
-    std::map<key_type, link_type>* children_;
+    ChildMap* children_;
   };
 
  public:
   typedef RecTree_iterator iterator;
   typedef RecTree_const_iterator const_iterator;
 
-  typedef std::map<key_type, link_type>::iterator map_iterator;
-  typedef std::map<key_type, link_type>::const_iterator map_const_iterator;
+  typedef rectree_map::iterator map_iterator;
+  typedef rectree_map::const_iterator map_const_iterator;
+  typedef std::shared_ptr<TreeArena> arena_type;
 
  public:
-  RecTree() : key_(), valueStatus_(INITAL) { nodeValue_.children_ = nullptr; }
+  RecTree() : key_(), valueStatus_(INITAL), childStorage_(MAP_CHILDREN) {
+    nodeValue_.children_ = nullptr;
+  }
 
   ~RecTree() { clear(); }
 
-  explicit RecTree(const std::string& key) : key_(key), valueStatus_(INITAL) {
+  explicit RecTree(const std::string& key)
+      : key_(key), valueStatus_(INITAL), childStorage_(MAP_CHILDREN) {
+    nodeValue_.children_ = nullptr;
+  }
+
+  // A tree whose nodes, values, maps and keys all come from `arena`, for
+  // large trees built once and dropped as a whole, such as parsed configs:
+  //
+  //   dblisp::RecTree config("config", std::make_shared<dblisp::TreeArena>());
+  //
+  // Destroying the tree still runs the destructors of its nodes, to free
+  // strings too long to be stored inline, but returns no memory node by
+  // node; the arena's blocks are released together once no tree, subtree
+  // or key refers to them any more.
+  //
+  // `storage` picks the child container of every node of the tree; flat
+  // children suit trees that are mostly read. A null `arena` gives a heap
+  // tree with that storage.
+  RecTree(const std::string& key, const arena_type& arena,
+          const CHILD_STORAGE storage = MAP_CHILDREN)
+      : arena_(arena),
+        key_(key, arena),
+        valueStatus_(INITAL),
+        childStorage_(storage) {
     nodeValue_.children_ = nullptr;
   }
 
   RecTree(RecTree&& x)
-      : key_(std::move(x.key_)),
+      : arena_(x.arena_),
+        key_(std::move(x.key_)),
         nodeValue_(x.nodeValue_),
-        valueStatus_(x.valueStatus_) {
+        valueStatus_(x.valueStatus_),
+        childStorage_(x.childStorage_) {
+    TreeGeneration::bump();
     x.valueStatus_ = INITAL;
     x.nodeValue_.children_ = nullptr;
   }
 
-  RecTree(const RecTree& x) { copy(x); }
+  // Copies are plain heap trees with the child storage of `x`, whatever
+  // the allocation of `x`. A copy of a heap tree costs O(1): it shares the
+  // children of `x`, and a node of either tree copies one level of its
+  // children, each still sharing theirs, on the first non-const access to
+  // them; see detach(). That access invalidates references and iterators
+  // to the children and below taken before it, in the same tree or, when
+  // the tree was just copied, from the tree copied. Take them again after
+  // copying, and hold ones from const access only while not writing.
+  //
+  // A shared node is never written, so copies may be used by different
+  // threads, each tree by one thread at a time as ever.
+  RecTree(const RecTree& x)
+      : key_(x.arena_ == nullptr ? x.key_ : key_type(x.refRealKey())),
+        childStorage_(x.childStorage_) {
+    copy(x);
+  }
 
   RecTree& operator=(RecTree x) {
     swap(x);
     return *this;
   }
 
+  // The arenas are swapped along with the contents they hold.
   void swap(RecTree& x) noexcept {
+    TreeGeneration::bump();
+    arena_.swap(x.arena_);
     key_.swap(x.key_);
     std::swap(nodeValue_, x.nodeValue_);
     std::swap(valueStatus_, x.valueStatus_);
+    std::swap(childStorage_, x.childStorage_);
   }
 
   std::ostream& formatLisp(std::ostream& outStream) const {
-    outStream << formatLisp();
+    StreamSink sink(outStream);
+    writeLisp(sink);
     return outStream;
   }
 
   std::string formatLisp() const {
     std::string lispStr;
-    formatLisp(this, 0, lispStr);
+    StringSink sink(lispStr);
+    writeLisp(sink);
     return lispStr;
   }
 
-  const std::vector<ValType>& valueVector() const {
-    if (isSingleValue()) const_cast<link_type>(this)->moveValToVec();
-    return refValVector();
+  // Writes the tree as dblisp text straight to `sink`, one of those of
+  // lisp-writer.h or any type with their write(). False if the sink failed.
+  template <typename Sink>
+  bool writeLisp(Sink& sink, const LISP_FORMAT format = LISP_PRETTY) const {
+    LispWriter<Sink> writer(sink, format);
+    writeLisp(this, 0, writer);
+    return writer.ok();
   }
 
+  const std::vector<ValType>& valueVector() const { return refValVector(); }
+
   std::vector<ValType>& valueVector() {
     if (isSingleValue()) moveValToVec();
     return refValVector();
@@ -321,11 +901,24 @@ class RecTree {
 
   key_type key() const { return key_; }
 
-  iterator begin() { return refChildren().begin(); }
+  // The arena of this tree, or null for a heap tree.
+  const arena_type& arena() const { return arena_; }
+
+  CHILD_STORAGE childStorage() const { return childStorage_; }
+
+  // The non-const accessors of children detach() first, so prefer the
+  // const ones, such as cbegin(), to only read a tree that may be shared.
+  iterator begin() {
+    detach();
+    return refChildren().begin();
+  }
 
   const_iterator begin() const { return refChildren().begin(); }
 
-  iterator end() { return refChildren().end(); }
+  iterator end() {
+    detach();
+    return refChildren().end();
+  }
 
   const_iterator end() const { return refChildren().end(); }
 
@@ -333,9 +926,16 @@ class RecTree {
 
   const_iterator cend() const { return refChildren().end(); }
 
+  // An iterator taken from a const tree may point into children shared
+  // with a copy, so it is moved to the same place in the detached ones.
   iterator erase(const_iterator pos) {
-    freeTree(pos.node_->second);
-    return refChildren().erase(pos.node_);
+    if (refChildren().shared()) {
+      auto index = std::distance(cbegin(), pos);
+      detach();
+      pos = std::next(cbegin(), index);
+    }
+    freeTree(pos.link());
+    return refChildren().erase(pos);
   }
 
   size_t erase(const std::string& key) {
@@ -346,28 +946,116 @@ class RecTree {
   }
 
   iterator erase(const_iterator first, const_iterator last) {
+    if (refChildren().shared()) {
+      auto firstIndex = std::distance(cbegin(), first);
+      auto lastIndex = std::distance(cbegin(), last);
+      detach();
+      first = std::next(cbegin(), firstIndex);
+      last = std::next(cbegin(), lastIndex);
+    }
     for (auto pos = first; pos != last; ++pos) {
-      freeTree(pos.node_->second);
+      freeTree(pos.link());
     }
-    return refChildren().erase(first.node_, last.node_);
+    return refChildren().erase(first, last);
   }
 
+  // Lookups by key never allocate.
   const_iterator find(const std::string& key) const {
-    return refChildren().find(key_type(key));
+    return refChildren().find(key.data(), key.size());
   }
 
   iterator find(const std::string& key) {
-    return refChildren().find(key_type(key));
+    return find(key.data(), key.size());
+  }
+
+  const_iterator find(const char* key) const {
+    return refChildren().find(key, std::strlen(key));
+  }
+
+  iterator find(const char* key) { return find(key, std::strlen(key)); }
+
+  const_iterator find(const char* key, const size_t size) const {
+    return refChildren().find(key, size);
+  }
+
+  iterator find(const char* key, const size_t size) {
+    detach();
+    return refChildren().find(key, size);
+  }
+
+  // Node at `path` below this one, or null where a segment is missing or
+  // reaches a value early. A node found is remembered in `path`; see
+  // KeyPath.
+  const RecTree* findPath(const KeyPath& path) const {
+    const RecTree* tree = path.remembered(this, false);
+    if (tree != nullptr) return tree;
+    tree = this;
+    for (const auto& key : path.keys()) {
+      if (!tree->isTree()) return nullptr;
+      const_iterator pos = tree->find(key);
+      if (pos == tree->end()) return nullptr;
+      tree = &*pos;
+    }
+    path.remember(this, tree, false);
+    return tree;
+  }
+
+  RecTree* findPath(const KeyPath& path) {
+    const RecTree* found = path.remembered(this, true);
+    if (found != nullptr) return const_cast<RecTree*>(found);
+    RecTree* tree = this;
+    for (const auto& key : path.keys()) {
+      if (!tree->isTree()) return nullptr;
+      iterator pos = tree->find(key);
+      if (pos == tree->end()) return nullptr;
+      tree = &*pos;
+    }
+    path.remember(this, tree, true);
+    return tree;
   }
 
   bool empty() const { return size() == 0; }
 
   const RecTree& at(const std::string& key) const {
-    return *refChildren().at(key_type(key));
+    return *refChildren().at(key.data(), key.size());
   }
 
   RecTree& at(const std::string& key) {
-    return *refChildren().at(key_type(key));
+    detach();
+    return *refChildren().at(key.data(), key.size());
+  }
+
+  const RecTree& at(const char* key) const {
+    return *refChildren().at(key, std::strlen(key));
+  }
+
+  RecTree& at(const char* key) {
+    detach();
+    return *refChildren().at(key, std::strlen(key));
+  }
+
+  // Throws std::out_of_range where findPath() would return null.
+  const RecTree& at(const KeyPath& path) const {
+    const RecTree* tree = findPath(path);
+    if (tree == nullptr) {
+      throw std::out_of_range("dblisp::RecTree::at");
+    }
+    return *tree;
+  }
+
+  RecTree& at(const KeyPath& path) {
+    RecTree* tree = findPath(path);
+    if (tree == nullptr) {
+      throw std::out_of_range("dblisp::RecTree::at");
+    }
+    return *tree;
+  }
+
+  // Splits `path` at `separator` once, for repeated findPath() or at()
+  // calls; empty segments are empty keys.
+  static KeyPath splitPath(const std::string& path,
+                           const char separator = '/') {
+    return KeyPath(path, separator);
   }
 
   size_t count() const { return count(this); }
@@ -394,7 +1082,7 @@ class RecTree {
 
   template <typename... types>
   std::pair<iterator, bool> emplace(const std::string& key, types&&... args) {
-    std::pair<map_iterator, bool> prIB;
+    std::pair<iterator, bool> prIB;
     switch (valueStatus_) {
       case VALUE:
         freeValue();
@@ -403,12 +1091,17 @@ class RecTree {
         freeValVector();
         break;
       case RECTREE:
-        prIB = refChildren().emplace(key, nullptr);
+        prIB.first = find(key);
+        if (prIB.first != end()) {
+          prIB.second = false;
+          return prIB;
+        }
+        prIB = refChildren().emplace(key_type(key, arena_), nullptr);
         if (prIB.second) {
-          prIB.first->second =
-              createTree(prIB.first->first, std::forward<types>(args)...);
+          prIB.first.linkRef() =
+              createTree(prIB.first.keyRef(), std::forward<types>(args)...);
         }
-        return {prIB.first, prIB.second};
+        return prIB;
         break;
       default:;
     }
@@ -420,8 +1113,8 @@ class RecTree {
   }
 
   template <typename RecType>
-  std::pair<map_iterator, bool> emplace(RecType&& recTree) {
-    std::pair<map_iterator, bool> prIB;
+  std::pair<iterator, bool> emplace(RecType&& recTree) {
+    std::pair<iterator, bool> prIB;
     switch (valueStatus_) {
       case VALUE:
         freeValue();
@@ -430,19 +1123,19 @@ class RecTree {
         freeValVector();
         break;
       case RECTREE:
+        detach();
         prIB = refChildren().emplace(recTree.key_, nullptr);
         if (prIB.second) {
-          prIB.first->second = createTree(std::forward<RecType>(recTree));
+          prIB.first.linkRef() = createTree(std::forward<RecType>(recTree));
         }
-        return {prIB.first, prIB.second};
+        return prIB;
         break;
       default:;
     }
     valueStatus_ = RECTREE;
     nodeValue_.children_ = createChildren();
-    prIB = refChildren().emplace(recTree.key_,
-                                 createTree(std::forward<RecType>(recTree)));
-    return {prIB.first, prIB.second};
+    link_type linkTree = createTree(std::forward<RecType>(recTree));
+    return refChildren().emplace(linkTree->key_, linkTree);
   }
 
   RecTree& operator[](const std::string& key) { return *(emplace(key).first); }
@@ -464,13 +1157,13 @@ class RecTree {
   }
 
  public:
-  ValType& value(const size_t index = 0) const {
-    if (isSingleValue()) {
-      if (index == 0) {
-        return refValue();
-      }
-    }
-    return (*nodeValue_.valueVec_)[index];
+  const ValType& value(const size_t index = 0) const {
+    return refValVector()[index];
+  }
+
+  ValType& value(const size_t index = 0) {
+    return const_cast<ValType&>(
+        static_cast<const RecTree*>(this)->value(index));
   }
 
   bool isValue() const {
@@ -479,18 +1172,37 @@ class RecTree {
 
   bool isMap() const { return isTree(); }
 
-  void pushValue(const std::string& val) {
+  // Values of a value node, 0 for other nodes.
+  size_t valueCount() const {
+    return isSingleValue()                ? 1
+           : valueStatus_ == VALUE_VECTOR ? refValVector().size()
+                                          : 0;
+  }
+
+  // All values of a value node as numbers, read through the cache of each
+  // ValType. False, leaving `values` as is, if the node has no values or
+  // one of them is not a number of the type.
+  bool intValues(std::vector<long long int>& values) const {
+    return numberValues(values, &ValType::asLLInt);
+  }
+
+  bool doubleValues(std::vector<double>& values) const {
+    return numberValues(values, &ValType::asDouble);
+  }
+
+  void pushValue(std::string val) {
     switch (valueStatus_) {
       case VALUE:
         moveValToVec();
+        // fall through
       case VALUE_VECTOR:
-        refValVector().emplace_back(val);
+        refValVector().emplace_back(std::move(val));
         return;
         break;
       default:;
     }
     clearNodeValue();
-    nodeValue_.value_ = createValue(val);
+    nodeValue_.valueVec_ = createValue(std::move(val));
     valueStatus_ = VALUE;
   }
 
@@ -507,6 +1219,69 @@ class RecTree {
   ValType& operator[](const size_t index) { return value(index); }
 
  private:
+  template <typename T>
+  bool numberValues(std::vector<T>& values,
+                    bool (ValType::*as)(T&) const) const {
+    size_t count = valueCount();
+    if (count == 0) {
+      return false;
+    }
+    std::vector<T> valuesTemp(count);
+    for (size_t i = 0; i != count; ++i) {
+      if (!(value(i).*as)(valuesTemp[i])) {
+        return false;
+      }
+    }
+    values.swap(valuesTemp);
+    return true;
+  }
+
+  // Children are constructed with their parent's arena and child storage.
+  // A child taken from a tree that differs in either is copied rather than
+  // moved, so that everything below a node is allocated and laid out alike.
+  RecTree(const RecTree* parent, const key_type& key)
+      : arena_(parent->arena_),
+        key_(key),
+        valueStatus_(INITAL),
+        childStorage_(parent->childStorage_) {
+    nodeValue_.children_ = nullptr;
+  }
+
+  RecTree(const RecTree* parent, std::string key)
+      : arena_(parent->arena_),
+        key_(std::move(key), parent->arena_),
+        valueStatus_(INITAL),
+        childStorage_(parent->childStorage_) {
+    nodeValue_.children_ = nullptr;
+  }
+
+  RecTree(const RecTree* parent, const RecTree& x)
+      : arena_(parent->arena_),
+        key_(parent->sameLayout(x) ? x.key_
+                                   : key_type(x.refRealKey(), parent->arena_)),
+        childStorage_(parent->childStorage_) {
+    copy(x);
+  }
+
+  RecTree(const RecTree* parent, RecTree&& x)
+      : arena_(parent->arena_),
+        key_(parent->sameLayout(x) ? std::move(x.key_)
+                                   : key_type(x.refRealKey(), parent->arena_)),
+        childStorage_(parent->childStorage_) {
+    if (!sameLayout(x)) {
+      copy(x);
+      return;
+    }
+    nodeValue_ = x.nodeValue_;
+    valueStatus_ = x.valueStatus_;
+    x.valueStatus_ = INITAL;
+    x.nodeValue_.children_ = nullptr;
+  }
+
+  bool sameLayout(const RecTree& x) const {
+    return arena_ == x.arena_ && childStorage_ == x.childStorage_;
+  }
+
   size_t count(const RecTree* const tree) const {
     size_t ret = 0;
     switch (tree->valueStatus_) {
@@ -525,64 +1300,64 @@ class RecTree {
 
   size_t countChilren() const {
     size_t ret = 0;
-    for (const auto& p : this->refChildren()) {
-      ret += count(p.second);
+    for (const auto& child : this->refChildren()) {
+      ret += count(&child);
     }
     return ret;
   }
 
  private:
-  bool formatLisp(const RecTree* const tPtr, size_t preSpaceCount,
-                  std::string& lispStr) const {
-    std::string lispVal;
+  template <typename Sink>
+  bool writeLisp(const RecTree* const tPtr, size_t preSpaceCount,
+                 LispWriter<Sink>& writer) const {
     bool newline = false;
     size_t spaceCount = preSpaceCount;
+    if (!writer.ok()) {
+      return false;
+    }
     switch (tPtr->valueStatus_) {
       case INITAL:
-        lispStr.append("(")
-            .append(toLispVal(tPtr->refRealKey()))
-            .push_back(')');
+        writer.put('(');
+        writer.quoted(tPtr->refRealKey());
+        writer.put(')');
         break;
       case VALUE:
-        lispStr.append("(")
-            .append(toLispVal(tPtr->refRealKey()))
-            .append(" ")
-            .append(toLispVal(tPtr->refRealVal()))
-            .push_back(')');
+        writer.put('(');
+        writer.quoted(tPtr->refRealKey());
+        writer.put(' ');
+        writer.quoted(tPtr->refRealVal());
+        writer.put(')');
         break;
       case VALUE_VECTOR:
-        lispStr.append("(").append(toLispVal(tPtr->refRealKey()));
+        writer.put('(');
+        writer.quoted(tPtr->refRealKey());
         for (const auto& val : tPtr->refValVector()) {
-          lispStr.append(" ").append(toLispVal(val));
+          writer.put(' ');
+          writer.quoted(val.valStr_);
         }
-        lispStr.push_back(')');
+        writer.put(')');
         break;
       case RECTREE:
-        lispVal = toLispVal(tPtr->refRealKey());
-        lispStr.append("(").append(lispVal).push_back(' ');
+        writer.put('(');
+        preSpaceCount += writer.quoted(tPtr->refRealKey()) + 2;
+        writer.put(' ');
         if (tPtr->empty()) {
-          lispStr.push_back(')');
+          writer.put(')');
         } else if (tPtr->size() == 1) {
-          preSpaceCount += lispVal.size() + 2;
-          newline = (formatLisp(tPtr->begin().node_->second, preSpaceCount,
-                                lispStr) ||
-                     newline);
+          newline = writeLisp(&*tPtr->begin(), preSpaceCount, writer);
           if (newline) {
-            lispStr.push_back('\n');
-            lispStr.append(std::string(spaceCount, ' '));
+            writer.newline(spaceCount, "");
           }
-          lispStr.push_back(')');
+          writer.put(')');
         } else {
           newline = true;
-          preSpaceCount += lispVal.size() + 2;
-          formatLisp(tPtr->begin().node_->second, preSpaceCount, lispStr);
+          writeLisp(&*tPtr->begin(), preSpaceCount, writer);
           for (auto iter = ++tPtr->begin(); iter != tPtr->end(); ++iter) {
-            lispStr.push_back('\n');
-            lispStr.append(std::string(preSpaceCount, ' '));
-            formatLisp(iter.node_->second, preSpaceCount, lispStr);
+            writer.newline(preSpaceCount, " ");
+            writeLisp(&*iter, preSpaceCount, writer);
           }
-          lispStr.push_back('\n');
-          lispStr.append(std::string(spaceCount, ' ')).push_back(')');
+          writer.newline(spaceCount, "");
+          writer.put(')');
         }
         break;
       default:;
@@ -590,29 +1365,10 @@ class RecTree {
     return newline;
   }
 
-  std::string toLispVal(const std::string& originVal) const {
-    std::string val("\"");
-    val.reserve(originVal.size());
-    for (const auto& c : originVal) {
-      if (c == '"') {
-        val.append("\\\"");
-      } else {
-        val.push_back(c);
-      }
-    }
-    val.push_back('"');
-    return val;
-  }
-
   bool isTree() const { return valueStatus_ == RECTREE; }
 
-  void moveValToVec() {
-    ValType tempVal = std::move(*nodeValue_.value_);
-    freeValue();
-    nodeValue_.valueVec_ = createValVector();
-    nodeValue_.valueVec_->emplace_back(std::move(tempVal));
-    valueStatus_ = VALUE_VECTOR;
-  }
+  // A single value is already a vector of one.
+  void moveValToVec() { valueStatus_ = VALUE_VECTOR; }
 
   bool isSingleValue() const { return valueStatus_ == VALUE; }
 
@@ -620,26 +1376,44 @@ class RecTree {
 #ifdef _DBLISP_TEST_DEBUG_
     std::cout << "copy: " << x.key_ << std::endl;
 #endif
-    this->key_ = key_type(x.refRealKey());
     this->valueStatus_ = x.valueStatus_;
     switch (x.valueStatus_) {
       case VALUE:
-        this->nodeValue_.value_ = this->createValue(x.refRealVal());
-        break;
       case VALUE_VECTOR:
         this->nodeValue_.valueVec_ = this->createValVector(x.refValVector());
         break;
       case RECTREE:
-        this->nodeValue_.children_ = this->copyChildren(x.refChildren());
+        if (sameLayout(x)) {
+          x.refChildren().acquire();
+          this->nodeValue_.children_ = x.nodeValue_.children_;
+        } else {
+          this->nodeValue_.children_ = this->copyChildren(x.refChildren());
+        }
         break;
       default:;
     }
     return this;
   }
 
+  // Gives this node children of its own before they are changed or handed
+  // out for writing. The new children share their own children in turn, so
+  // this copies one level, and a write deep in a copied tree copies the
+  // levels on its path only.
+  void detach() {
+    if (!isTree() || !refChildren().shared()) {
+      return;
+    }
+    ChildMap* children = copyChildren(refChildren());
+    clearChildren();
+    nodeValue_.children_ = children;
+  }
+
   void clearChildren() {
-    for (const auto& p : this->refChildren()) {
-      freeTree(p.second);
+    if (!this->refChildren().release()) {
+      return;
+    }
+    for (auto& child : this->refChildren()) {
+      freeTree(&child);
     }
     this->refChildren().clear();
     this->freeChildren();
@@ -661,11 +1435,13 @@ class RecTree {
     valueStatus_ = INITAL;
   }
 
-  ValType* createValue(const std::string& val) {
+  std::vector<ValType>* createValue(std::string val) {
 #ifdef _DBLISP_TEST_DEBUG_
     std::cout << "createValue: " << val << std::endl;
 #endif
-    return new ValType(val);
+    std::vector<ValType>* valueVec = createValVector();
+    valueVec->emplace_back(std::move(val));
+    return valueVec;
   }
 
   std::string& refRealKey() const { return *key_.keyPtr_; }
@@ -674,46 +1450,48 @@ class RecTree {
 #ifdef _DBLISP_TEST_DEBUG_
     std::cout << "freeValue: " << value() << std::endl;
 #endif
-    delete nodeValue_.value_;
+    freeValVector();
   }
 
   template <typename... types>
   std::vector<ValType>* createValVector(types&&... args) {
-    return new std::vector<ValType>(std::forward<types>(args)...);
+    return TreeArena::create<std::vector<ValType>>(
+        arena_.get(), std::forward<types>(args)...);
   }
 
-  void freeValVector() { delete nodeValue_.valueVec_; }
+  void freeValVector() {
+    TreeArena::destroy(arena_.get(), nodeValue_.valueVec_);
+  }
 
-  ValType& refValue() const { return *nodeValue_.value_; }
+  ValType& refValue() const { return refValVector().front(); }
 
   std::string& refRealVal() const { return refValue().valStr_; }
 
   std::vector<ValType>& refValVector() const { return *nodeValue_.valueVec_; }
 
-  std::map<key_type, link_type>& refChildren() const {
-    return *nodeValue_.children_;
-  }
+  ChildMap& refChildren() const { return *nodeValue_.children_; }
 
-  std::map<key_type, link_type>* copyChildren(
-      const std::map<key_type, link_type>& chidlren) {
+  ChildMap* copyChildren(ChildMap& chidlren) {
     auto child = createChildren();
-    for (const auto& p : chidlren) {
-      link_type tree = createTree(*p.first.keyPtr_);
-      child->emplace(tree->key_, tree->copy(*p.second));
+    for (const auto& tree : chidlren) {
+      link_type copied = createTree(tree);
+      child->append(copied->key_, copied);
     }
     return child;
   }
 
-  template <typename... types>
-  std::map<key_type, link_type>* createChildren(types&&... args) {
-    return new std::map<key_type, link_type>(std::forward<types>(args)...);
+  ChildMap* createChildren() {
+    return TreeArena::create<ChildMap>(arena_.get(), childStorage_, arena_);
   }
 
-  void freeChildren() { delete nodeValue_.children_; }
+  void freeChildren() {
+    TreeArena::destroy(arena_.get(), nodeValue_.children_);
+  }
 
   template <typename... types>
-  link_type createTree(types... args) {
-    link_type tree = new RecTree(std::forward<types>(args)...);
+  link_type createTree(types&&... args) {
+    link_type tree = TreeArena::create<RecTree>(arena_.get(), this,
+                                                std::forward<types>(args)...);
 #ifdef _DBLISP_TEST_DEBUG_
     std::cout << "createTree: " << tree->key_ << std::endl;
 #endif
@@ -724,14 +1502,15 @@ class RecTree {
 #ifdef _DBLISP_TEST_DEBUG_
     std::cout << "freeTree: " << treePtr->key_ << std::endl;
 #endif
-    treePtr->clear();
-    delete treePtr;
+    TreeArena::destroy(arena_.get(), treePtr);
   }
 
  private:
+  arena_type arena_;
   key_type key_;
   union value_type nodeValue_;
   VALUE_TYPE valueStatus_;
+  CHILD_STORAGE childStorage_;
 };
 }  // namespace dblisp
 #undef DBLISP_TEST_DEBUG
@@ -0,0 +1,142 @@
+#ifndef _DBLISP_TREE_ARENA_H_
+#define _DBLISP_TREE_ARENA_H_
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+namespace dblisp {
+
+// Monotonic block allocator behind an arena-backed RecTree. Nodes, values,
+// value vectors, child maps and key strings of the tree are carved from a
+// few large blocks instead of one heap allocation each; freeing them is a
+// no-op, and the blocks go back to the heap in one step when the last tree
+// referencing the arena is destroyed. Not thread-safe, like the tree.
+class TreeArena {
+  enum { MIN_BLOCK_SIZE = 64 << 10, MAX_BLOCK_SIZE = 16 << 20 };
+
+ public:
+  TreeArena()
+      : current_(nullptr), end_(nullptr), next_(MIN_BLOCK_SIZE), capacity_(0) {}
+
+  ~TreeArena() {
+    for (auto block : blocks_) {
+      ::operator delete(block);
+    }
+  }
+
+  TreeArena(const TreeArena&) = delete;
+
+  TreeArena& operator=(const TreeArena&) = delete;
+
+  void* allocate(const size_t size, const size_t align) {
+    char* first = alignUp(current_, align);
+    if (first == nullptr || first + size > end_) {
+      grow(size + align);
+      first = alignUp(current_, align);
+    }
+    current_ = first + size;
+    return first;
+  }
+
+  // Bytes reserved from the heap so far.
+  size_t capacity() const { return capacity_; }
+
+  // Objects made by create() need destroy() only to run their destructor.
+  template <typename T, typename... types>
+  static T* create(TreeArena* arena, types&&... args) {
+    if (arena == nullptr) {
+      return new T(std::forward<types>(args)...);
+    }
+    return new (arena->allocate(sizeof(T), alignof(T)))
+        T(std::forward<types>(args)...);
+  }
+
+  template <typename T>
+  static void destroy(TreeArena* arena, T* object) {
+    if (arena == nullptr) {
+      delete object;
+    } else {
+      object->~T();
+    }
+  }
+
+ private:
+  static char* alignUp(char* ptr, const size_t align) {
+    if (ptr == nullptr) {
+      return nullptr;
+    }
+    size_t offset = reinterpret_cast<size_t>(ptr) & (align - 1);
+    return offset == 0 ? ptr : ptr + (align - offset);
+  }
+
+  void grow(const size_t minSize) {
+    size_t size = next_ < minSize ? minSize : next_;
+    if (next_ < MAX_BLOCK_SIZE) {
+      next_ *= 2;
+    }
+    blocks_.push_back(static_cast<char*>(::operator new(size)));
+    current_ = blocks_.back();
+    end_ = current_ + size;
+    capacity_ += size;
+  }
+
+ private:
+  std::vector<char*> blocks_;
+  char* current_;
+  char* end_;
+  size_t next_;
+  size_t capacity_;
+};
+
+// Standard allocator over an optional TreeArena, falling back to the heap
+// without one. It holds a reference to the arena, so a key or map that
+// outlives its tree keeps the arena alive.
+template <typename T>
+class TreeAllocator {
+  template <typename U>
+  friend class TreeAllocator;
+
+ public:
+  typedef T value_type;
+
+  TreeAllocator() = default;
+
+  explicit TreeAllocator(const std::shared_ptr<TreeArena>& arena)
+      : arena_(arena) {}
+
+  template <typename U>
+  TreeAllocator(const TreeAllocator<U>& x) : arena_(x.arena_) {}
+
+  T* allocate(const size_t n) {
+    if (arena_ == nullptr) {
+      return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+    return static_cast<T*>(arena_->allocate(n * sizeof(T), alignof(T)));
+  }
+
+  void deallocate(T* ptr, size_t) {
+    if (arena_ == nullptr) {
+      ::operator delete(ptr);
+    }
+  }
+
+  template <typename U>
+  bool operator==(const TreeAllocator<U>& x) const {
+    return arena_ == x.arena_;
+  }
+
+  template <typename U>
+  bool operator!=(const TreeAllocator<U>& x) const {
+    return arena_ != x.arena_;
+  }
+
+ private:
+  std::shared_ptr<TreeArena> arena_;
+};
+
+}  // namespace dblisp
+
+#endif
@@ -0,0 +1,451 @@
+#ifndef _DBLISP_TREE_SNAPSHOT_H_
+#define _DBLISP_TREE_SNAPSHOT_H_
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "../common/mapped-file.h"
+#include "recursive-map.h"
+
+namespace dblisp {
+
+enum SNAPSHOT_NODE { SNAPSHOT_EMPTY, SNAPSHOT_VALUES, SNAPSHOT_TREE };
+
+// Node record of a snapshot. A tree node's children are the `count`
+// records from index `first`, sorted by key; a value node's values are the
+// same range of the value table.
+struct SnapshotNode {
+  uint64_t key;
+  uint32_t keySize;
+  uint32_t type;
+  uint64_t first;
+  uint64_t count;
+};
+
+// A string of the string table, where each is also NUL terminated.
+struct SnapshotString {
+  uint64_t offset;
+  uint64_t size;
+};
+
+struct SnapshotImage {
+  const SnapshotNode* nodes;
+  const SnapshotString* values;
+  const char* strings;
+  uint64_t nodeCount;
+  uint64_t valueCount;
+  uint64_t stringBytes;
+};
+
+// Read-only node of a TreeSnapshot with the lookup side of the RecTree
+// API. A view is two pointers into the mapped image, cheap to copy and
+// valid while its snapshot stays open.
+class TreeView {
+  friend class TreeSnapshot;
+
+ public:
+  // Dereferences to a child view by value, so there is no operator->.
+  class const_iterator {
+   public:
+    typedef std::bidirectional_iterator_tag iterator_category;
+    typedef TreeView value_type;
+    typedef TreeView reference;
+    typedef void pointer;
+    typedef ptrdiff_t difference_type;
+
+    const_iterator() : image_(nullptr), node_(nullptr) {}
+
+    const_iterator(const SnapshotImage* image, const SnapshotNode* node)
+        : image_(image), node_(node) {}
+
+    bool operator==(const const_iterator& x) const { return node_ == x.node_; }
+
+    bool operator!=(const const_iterator& x) const { return node_ != x.node_; }
+
+    reference operator*() const { return TreeView(image_, node_); }
+
+    const_iterator& operator++() {
+      ++node_;
+      return *this;
+    }
+
+    const_iterator& operator--() {
+      --node_;
+      return *this;
+    }
+
+    const_iterator operator++(int) {
+      auto temp = *this;
+      operator++();
+      return temp;
+    }
+
+    const_iterator operator--(int) {
+      auto temp = *this;
+      operator--();
+      return temp;
+    }
+
+   private:
+    const SnapshotImage* image_;
+    const SnapshotNode* node_;
+  };
+
+  typedef const_iterator iterator;
+
+  TreeView() : image_(nullptr), node_(nullptr) {}
+
+  // True for the view findPath() returns for a missing path.
+  bool isNull() const { return node_ == nullptr; }
+
+  std::string key() const {
+    return std::string(image_->strings + node_->key, node_->keySize);
+  }
+
+  bool isValue() const { return node_->type == SNAPSHOT_VALUES; }
+
+  bool isMap() const { return node_->type == SNAPSHOT_TREE; }
+
+  size_t size() const { return isMap() ? node_->count : 0; }
+
+  bool empty() const { return size() == 0; }
+
+  size_t valueCount() const { return isValue() ? node_->count : 0; }
+
+  ValType value(const size_t index = 0) const {
+    const SnapshotString& value = image_->values[node_->first + index];
+    return ValType(std::string(image_->strings + value.offset, value.size));
+  }
+
+  size_t count() const {
+    size_t ret = 1;
+    for (const auto& child : *this) {
+      ret += child.count();
+    }
+    return ret;
+  }
+
+  const_iterator begin() const {
+    return const_iterator(image_, isMap() ? image_->nodes + node_->first
+                                          : nullptr);
+  }
+
+  const_iterator end() const {
+    return const_iterator(
+        image_, isMap() ? image_->nodes + node_->first + node_->count
+                        : nullptr);
+  }
+
+  const_iterator find(const std::string& key) const {
+    return find(key.data(), key.size());
+  }
+
+  const_iterator find(const char* key) const {
+    return find(key, std::strlen(key));
+  }
+
+  // Binary search over the sorted children.
+  const_iterator find(const char* key, const size_t size) const {
+    if (!isMap()) {
+      return end();
+    }
+    const SnapshotNode* first = image_->nodes + node_->first;
+    const SnapshotNode* last = first + node_->count;
+    const SnapshotNode* pos = std::lower_bound(
+        first, last, std::make_pair(key, size),
+        [this](const SnapshotNode& node,
+               const std::pair<const char*, size_t>& key) {
+          return compareKey(node, key.first, key.second) < 0;
+        });
+    return pos != last && compareKey(*pos, key, size) == 0
+               ? const_iterator(image_, pos)
+               : end();
+  }
+
+  // Null where a segment is missing or reaches a value early.
+  TreeView findPath(const KeyPath& path) const {
+    TreeView view = *this;
+    for (const auto& key : path.keys()) {
+      const_iterator pos = view.find(key);
+      if (pos == view.end()) {
+        return TreeView();
+      }
+      view = *pos;
+    }
+    return view;
+  }
+
+  TreeView at(const std::string& key) const {
+    return at(key.data(), key.size());
+  }
+
+  TreeView at(const char* key) const { return at(key, std::strlen(key)); }
+
+  // Throws std::out_of_range for a missing key, as RecTree::at() does.
+  TreeView at(const char* key, const size_t size) const {
+    const_iterator pos = find(key, size);
+    if (pos == end()) {
+      throw std::out_of_range("dblisp::TreeView::at");
+    }
+    return *pos;
+  }
+
+  TreeView at(const KeyPath& path) const {
+    TreeView view = findPath(path);
+    if (view.isNull()) {
+      throw std::out_of_range("dblisp::TreeView::at");
+    }
+    return view;
+  }
+
+ private:
+  TreeView(const SnapshotImage* image, const SnapshotNode* node)
+      : image_(image), node_(node) {}
+
+  int compareKey(const SnapshotNode& node, const char* key,
+                 const size_t size) const {
+    int ret = std::memcmp(image_->strings + node.key, key,
+                          std::min<size_t>(node.keySize, size));
+    if (ret != 0) {
+      return ret;
+    }
+    return node.keySize < size ? -1 : node.keySize > size ? 1 : 0;
+  }
+
+ private:
+  const SnapshotImage* image_;
+  const SnapshotNode* node_;
+};
+
+// Binary image of a RecTree that is used in place from an mmap, so opening
+// one costs the same whatever the size of the tree. The layout is
+//
+//   header       "DBLS", version, node, value and string table sizes
+//   node table   SnapshotNode records, the root first, then breadth first
+//   value table  SnapshotString records
+//   string table keys and values, each stored once, NUL terminated
+//
+// Everything is addressed by index or offset, never by pointer, so an
+// image can be copied and mapped anywhere. Numbers are in the byte order
+// of the machine that compiled the image. open() checks that the tables
+// fill the file exactly but trusts the records inside them; verify() checks
+// every record, once, for an image from a writer that is not trusted.
+class TreeSnapshot {
+  struct SnapshotHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t nodeCount;
+    uint64_t valueCount;
+    uint64_t stringBytes;
+  };
+
+  enum { SNAPSHOT_VERSION = 1 };
+
+ public:
+  TreeSnapshot() : image_{nullptr, nullptr, nullptr, 0, 0, 0} {}
+
+  bool open(const std::string& file) {
+    close();
+    if (!file_.open(file)) {
+      return errorLog("open error: " + file);
+    }
+    SnapshotHeader header;
+    uint64_t size = file_.size();
+    if (size < sizeof(header)) {
+      return invalid(file);
+    }
+    std::memcpy(&header, file_.data(), sizeof(header));
+    size -= sizeof(header);
+    if (std::memcmp(header.magic, "DBLS", 4) != 0 ||
+        header.version != SNAPSHOT_VERSION || header.nodeCount == 0 ||
+        header.nodeCount > size / sizeof(SnapshotNode)) {
+      return invalid(file);
+    }
+    size -= header.nodeCount * sizeof(SnapshotNode);
+    if (header.valueCount > size / sizeof(SnapshotString) ||
+        size - header.valueCount * sizeof(SnapshotString) !=
+            header.stringBytes) {
+      return invalid(file);
+    }
+    const char* data = file_.data() + sizeof(header);
+    image_.nodes = reinterpret_cast<const SnapshotNode*>(data);
+    data += header.nodeCount * sizeof(SnapshotNode);
+    image_.values = reinterpret_cast<const SnapshotString*>(data);
+    image_.strings = data + header.valueCount * sizeof(SnapshotString);
+    image_.nodeCount = header.nodeCount;
+    image_.valueCount = header.valueCount;
+    image_.stringBytes = header.stringBytes;
+    return true;
+  }
+
+  // Checks that every key and value lies in the string table followed by
+  // its NUL, and that every node's range lies in its table. Children must
+  // come after their parent, as compile() lays them out, so a walk of the
+  // tree always ends. Views of an image that passes stay in the mapping.
+  bool verify() const {
+    if (image_.nodes == nullptr) {
+      return errorLog("no snapshot open");
+    }
+    for (uint64_t index = 0; index != image_.nodeCount; ++index) {
+      const SnapshotNode& node = image_.nodes[index];
+      bool ok = validString(node.key, node.keySize);
+      switch (node.type) {
+        case SNAPSHOT_EMPTY:
+          ok = ok && node.count == 0;
+          break;
+        case SNAPSHOT_VALUES:
+          ok = ok && validRange(node.first, node.count, image_.valueCount);
+          break;
+        case SNAPSHOT_TREE:
+          ok = ok && node.first > index &&
+               validRange(node.first, node.count, image_.nodeCount);
+          break;
+        default:
+          ok = false;
+      }
+      if (!ok) {
+        return errorLog("corrupt node " + std::to_string(index));
+      }
+    }
+    for (uint64_t index = 0; index != image_.valueCount; ++index) {
+      const SnapshotString& value = image_.values[index];
+      if (!validString(value.offset, value.size)) {
+        return errorLog("corrupt value " + std::to_string(index));
+      }
+    }
+    return true;
+  }
+
+  void close() {
+    file_.close();
+    image_ = SnapshotImage{nullptr, nullptr, nullptr, 0, 0, 0};
+  }
+
+  TreeView root() const { return TreeView(&image_, image_.nodes); }
+
+  // Writes the image of `tree` to a temporary file renamed over `file`, so
+  // a process opening `file` meanwhile sees the old image or the new one.
+  static bool compile(const RecTree& tree, const std::string& file) {
+    std::vector<SnapshotNode> nodes;
+    std::vector<SnapshotString> values;
+    std::string strings;
+    std::unordered_map<std::string, uint64_t> offsets(2 * tree.count());
+    auto intern = [&](const std::string& str) {
+      auto found = offsets.find(str);
+      if (found != offsets.end()) {
+        return SnapshotString{found->second, str.size()};
+      }
+      uint64_t offset = strings.size();
+      offsets.emplace(str, offset);
+      strings.append(str).push_back('\0');
+      return SnapshotString{offset, str.size()};
+    };
+    std::vector<const RecTree*> trees(1, &tree);
+    for (size_t index = 0; index != trees.size(); ++index) {
+      const RecTree* node = trees[index];
+      SnapshotString key = intern(node->refRealKey());
+      SnapshotNode record{key.offset, static_cast<uint32_t>(key.size),
+                          SNAPSHOT_EMPTY, 0, 0};
+      switch (node->valueStatus_) {
+        case RecTree::VALUE:
+          record = SnapshotNode{key.offset, record.keySize, SNAPSHOT_VALUES,
+                                values.size(), 1};
+          values.push_back(intern(node->refRealVal()));
+          break;
+        case RecTree::VALUE_VECTOR:
+          record = SnapshotNode{key.offset, record.keySize, SNAPSHOT_VALUES,
+                                values.size(), node->refValVector().size()};
+          for (const auto& val : node->refValVector()) {
+            values.push_back(intern(val.valStr_));
+          }
+          break;
+        case RecTree::RECTREE:
+          record = SnapshotNode{key.offset, record.keySize, SNAPSHOT_TREE,
+                                trees.size(), node->size()};
+          for (const auto& child : *node) {
+            trees.push_back(&child);
+          }
+          break;
+        default:;
+      }
+      nodes.push_back(record);
+    }
+
+    SnapshotHeader header;
+    std::memcpy(header.magic, "DBLS", 4);
+    header.version = SNAPSHOT_VERSION;
+    header.nodeCount = nodes.size();
+    header.valueCount = values.size();
+    header.stringBytes = strings.size();
+    std::string tmpFile = file + ".tmp." + std::to_string(getpid());
+    int fd = ::open(tmpFile.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) {
+      return errorLog("can not create " + tmpFile);
+    }
+    bool ok = writeAll(fd, &header, sizeof(header)) &&
+              writeAll(fd, nodes.data(), nodes.size() * sizeof(SnapshotNode)) &&
+              writeAll(fd, values.data(),
+                       values.size() * sizeof(SnapshotString)) &&
+              writeAll(fd, strings.data(), strings.size());
+    ok = (::close(fd) == 0) && ok;
+    if (!ok || rename(tmpFile.c_str(), file.c_str()) != 0) {
+      unlink(tmpFile.c_str());
+      return errorLog("can not write " + file);
+    }
+    return true;
+  }
+
+ private:
+  static bool validRange(const uint64_t first, const uint64_t count,
+                         const uint64_t size) {
+    return first <= size && count <= size - first;
+  }
+
+  bool validString(const uint64_t offset, const uint64_t size) const {
+    return validRange(offset, size, image_.stringBytes) &&
+           size != image_.stringBytes - offset &&
+           image_.strings[offset + size] == '\0';
+  }
+
+  static bool writeAll(const int fd, const void* data, size_t size) {
+    const char* first = static_cast<const char*>(data);
+    while (size != 0) {
+      ssize_t written = ::write(fd, first, size);
+      if (written <= 0) {
+        return false;
+      }
+      first += written;
+      size -= written;
+    }
+    return true;
+  }
+
+  bool invalid(const std::string& file) {
+    close();
+    return errorLog("invalid snapshot: " + file);
+  }
+
+  static bool errorLog(const std::string& logInfo) {
+    std::cerr << "dblisp: snapshot: error: " << logInfo << std::endl;
+    return false;
+  }
+
+ private:
+  common::MappedFile file_;
+  SnapshotImage image_;
+};
+
+}  // namespace dblisp
+
+#endif
@@ -2,57 +2,397 @@
 #ifdef GPERF
 #include <google/profiler.h>
 #endif
+#include <climits>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
+#include <iomanip>
+#include <sstream>
+#include "lib/mydiff/anchored-diff.h"
+#include "lib/mydiff/arena.h"
+#include "lib/mydiff/base-diff.h"
+#include "lib/mydiff/binary-patch.h"
+#include "lib/mydiff/bounded-diff.h"
+#include "lib/mydiff/diff-cache.h"
+#include "lib/mydiff/edit-distance.h"
+#include "lib/mydiff/edit-runs.h"
+#include "lib/mydiff/file-cache.h"
+#include "lib/mydiff/line-loader.h"
+#include "lib/mydiff/lisp-diff.h"
+#include "lib/mydiff/move-detector.h"
 #include "lib/mydiff/myers-diff.h"
+#include "lib/mydiff/thread-pool.h"
+#include "lib/mydiff/tokenizer.h"
+#include "lib/mydiff/trace.h"
+#include "lib/mydiff/tree-diff.h"
+#include "lib/mydiff/unix-server.h"
+#include "lib/recursiveTree/dblisp-parser.h"
 
-bool tv(const std::string &file, std::vector<std::string> &vf) {
-  std::ifstream inf(file);
-  if (!inf.is_open()) {
-    std::cerr << "open error on " << file << std::endl;
+std::ostream &operator<<(std::ostream &out, const mydiff::Line *line) {
+  return out.write(line->data, line->size);
+}
+
+struct Options {
+  std::string srcf;
+  std::string dstf;
+  std::string cacheDir;
+  uint64_t cacheSize = 256ULL << 20;
+  std::string output;
+  bool binary = false;
+  bool moves = false;
+  bool anchor = false;
+  uint64_t hunks = 0;
+  bool distance = false;
+  int64_t within = -1;
+  mydiff::Tokenizer tokenizer;
+  bool apply = false;
+  uint64_t maxMemory = 0;
+  std::string manifest;
+  std::string base;
+  std::vector<std::string> targets;
+  bool tagged = false;
+  size_t jobs = 0;
+  bool tree = false;
+  mydiff::TreeDiffOptions treeOptions;
+  bool lisp = false;
+  std::string serve;
+  std::string connect;
+  uint64_t fileCacheSize = 512ULL << 20;
+  std::string request;
+  std::string trace;
+};
+
+typedef mydiff::ArenaAllocator<const mydiff::Line *> line_alloc_t;
+typedef std::vector<const mydiff::Line *, line_alloc_t> lines_t;
+typedef lines_t::const_iterator line_iter;
+typedef mydiff::ArenaAllocator<mydiff::ses_value_t<line_iter>> ses_alloc_t;
+typedef mydiff::MyersDiff<line_iter, std::equal_to<const mydiff::Line *>,
+                          ses_alloc_t>
+    engine_t;
+typedef mydiff::line_vector_t::const_iterator cached_iter;
+typedef mydiff::ArenaAllocator<mydiff::ses_value_t<cached_iter>>
+    cached_ses_alloc_t;
+typedef mydiff::MyersDiff<cached_iter, std::equal_to<const mydiff::Line *>,
+                          cached_ses_alloc_t>
+    cached_engine_t;
+
+void usage() {
+  std::cerr << "usage: mydiff [--trace file.json|file.folded] ...\n"
+               "       mydiff [--cache-dir dir] [--cache-size bytes] "
+               "[--max-memory size] [--anchor] [-j jobs]\n"
+               "              [--binary] [--moves] [-o output] "
+               "orcfile dstfile\n"
+               "       mydiff --hunks count srcfile dstfile\n"
+               "       mydiff --distance [--within edits] srcfile dstfile\n"
+               "       mydiff --tokens bytes|utf8|words|delims:SET [--anchor] "
+               "[-j jobs] [--max-memory size] srcfile dstfile\n"
+               "       mydiff --apply [-o output] basefile patchfile\n"
+               "       mydiff --batch manifest|- [-j jobs] [--tagged] "
+               "[--binary] [--moves] [--anchor] [--max-memory size]\n"
+               "       mydiff --base basefile [-j jobs] [--tagged] [--binary] "
+               "[--moves] [--anchor] [--max-memory size] target...\n"
+               "       mydiff --tree [-j jobs] [--no-renames] [--find-copies] "
+               "[--similarity percent] srcdir dstdir\n"
+               "       mydiff --lisp srcfile dstfile\n"
+               "       mydiff --serve socket [-j jobs] [--file-cache size] "
+               "[--max-memory size] [--anchor]\n"
+               "       mydiff --connect socket [--binary] [--moves] "
+               "[-o output] src dst\n"
+               "       mydiff --connect socket --load file | --stats | "
+               "--shutdown"
+            << std::endl;
+}
+
+// Parses a byte count with an optional K, M or G suffix.
+bool parseSize(const char *str, uint64_t &size) {
+  char *end;
+  size = std::strtoull(str, &end, 10);
+  if (end == str) {
+    return false;
+  }
+  const std::string units("KMG");
+  size_t unit = *end == '\0' ? std::string::npos : units.find(*end);
+  if (unit != std::string::npos) {
+    size <<= 10 * (unit + 1);
+    ++end;
+  }
+  return *end == '\0';
+}
+
+bool parseOptions(int argc, char **argv, Options &opts) {
+  std::vector<std::string> files;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg(argv[i]);
+    if (arg == "--cache-dir" && i + 1 < argc) {
+      opts.cacheDir = argv[++i];
+    } else if (arg == "--cache-size" && i + 1 < argc) {
+      if (!parseSize(argv[++i], opts.cacheSize)) return false;
+    } else if (arg == "--max-memory" && i + 1 < argc) {
+      if (!parseSize(argv[++i], opts.maxMemory)) return false;
+      uint64_t minMemory = mydiff::BoundedDiff<
+          line_iter, std::equal_to<const mydiff::Line *>>::minMemory();
+      if (opts.maxMemory != 0 && opts.maxMemory < minMemory) {
+        std::cerr << "mydiff: --max-memory must be at least " << minMemory
+                  << " bytes" << std::endl;
+        return false;
+      }
+    } else if (arg == "-o" && i + 1 < argc) {
+      opts.output = argv[++i];
+    } else if (arg == "--binary") {
+      opts.binary = true;
+    } else if (arg == "--moves") {
+      opts.moves = true;
+    } else if (arg == "--anchor") {
+      opts.anchor = true;
+    } else if (arg == "--hunks" && i + 1 < argc) {
+      if (!parseSize(argv[++i], opts.hunks) || opts.hunks == 0) {
+        return false;
+      }
+    } else if (arg == "--distance") {
+      opts.distance = true;
+    } else if (arg == "--within" && i + 1 < argc) {
+      uint64_t within;
+      if (!parseSize(argv[++i], within)) {
+        return false;
+      }
+      opts.distance = true;
+      opts.within = static_cast<int64_t>(within);
+    } else if (arg == "--tokens" && i + 1 < argc) {
+      if (!opts.tokenizer.parse(argv[++i])) return false;
+    } else if (arg == "--apply") {
+      opts.apply = true;
+    } else if (arg == "--batch" && i + 1 < argc) {
+      opts.manifest = argv[++i];
+    } else if (arg == "--base" && i + 1 < argc) {
+      opts.base = argv[++i];
+    } else if (arg == "--tagged") {
+      opts.tagged = true;
+    } else if ((arg == "-j" || arg == "--jobs") && i + 1 < argc) {
+      opts.jobs = std::strtoul(argv[++i], nullptr, 10);
+    } else if (arg == "--tree") {
+      opts.tree = true;
+    } else if (arg == "--no-renames") {
+      opts.treeOptions.findRenames = false;
+    } else if (arg == "--find-copies") {
+      opts.treeOptions.findCopies = true;
+    } else if (arg == "--similarity" && i + 1 < argc) {
+      opts.treeOptions.minScore = std::atoi(argv[++i]);
+      if (opts.treeOptions.minScore <= 0 || opts.treeOptions.minScore > 100) {
+        return false;
+      }
+    } else if (arg == "--lisp") {
+      opts.lisp = true;
+    } else if (arg == "--trace" && i + 1 < argc) {
+      opts.trace = argv[++i];
+    } else if (arg == "--serve" && i + 1 < argc) {
+      opts.serve = argv[++i];
+    } else if (arg == "--connect" && i + 1 < argc) {
+      opts.connect = argv[++i];
+    } else if (arg == "--file-cache" && i + 1 < argc) {
+      if (!parseSize(argv[++i], opts.fileCacheSize)) return false;
+    } else if (arg == "--load" || arg == "--stats" || arg == "--shutdown") {
+      opts.request = arg.substr(2);
+    } else if (arg.size() > 1 && arg[0] == '-') {
+      return false;
+    } else {
+      files.push_back(arg);
+    }
+  }
+  // --tokens is a mode of its own, with no other output format.
+  if (opts.tokenizer.mode() != mydiff::TM_LINES &&
+      (opts.apply || !opts.manifest.empty() || !opts.base.empty() ||
+       opts.tree || opts.lisp || !opts.serve.empty() ||
+       !opts.connect.empty() || opts.hunks != 0 || opts.distance ||
+       opts.binary || opts.moves)) {
     return false;
   }
-  std::string buf;
-  for (; getline(inf, buf);) {
-    vf.push_back(buf);
+  if (!opts.manifest.empty() || !opts.serve.empty()) {
+    return files.empty();
+  }
+  if (!opts.base.empty()) {
+    opts.targets = files;
+    return !files.empty();
+  }
+  if (!opts.connect.empty() && !opts.request.empty()) {
+    if (files.size() != (opts.request == "load" ? 1u : 0u)) {
+      return false;
+    }
+    opts.srcf = files.empty() ? "" : files[0];
+    return true;
   }
-  inf.close();
+  if (files.size() != 2) {
+    return false;
+  }
+  opts.srcf = files[0];
+  opts.dstf = files[1];
   return true;
 }
 
-int main(int argc, char **argv) {
-#ifdef GPERF
-  ProfilerStart("mydiff.prof");
-#endif
-  if (argc != 3) {
-    std::cerr << "usage: mydiff orcfile dstfile" << std::endl;
+// Writes the rebuilt target next to the requested output and renames it into
+// place only once both checksums have been verified.
+int applyPatch(const Options &opts) {
+  std::ifstream patch(opts.dstf, std::ios::binary);
+  if (!patch.is_open()) {
+    std::cerr << "open error on " << opts.dstf << std::endl;
     return 1;
   }
-  std::string srcf(argv[1]);
-  std::string dstf(argv[2]);
-  std::vector<std::string> src, dst;
-  if (!tv(srcf, src)) {
+  if (opts.output.empty()) {
+    return mydiff::BinaryPatch::apply(opts.srcf, patch, std::cout) ? 0 : 1;
+  }
+  std::string tmpOutput = opts.output + ".tmp." + std::to_string(getpid());
+  std::ofstream out(tmpOutput, std::ios::binary);
+  if (!out.is_open()) {
+    std::cerr << "open error on " << tmpOutput << std::endl;
     return 1;
   }
-  if (!tv(dstf, dst)) {
+  bool ok = mydiff::BinaryPatch::apply(opts.srcf, patch, out);
+  out.close();
+  if (!ok || !out || std::rename(tmpOutput.c_str(), opts.output.c_str())) {
+    std::remove(tmpOutput.c_str());
     return 1;
   }
-  mydiff::ses_t<std::vector<std::string>::iterator> ses;
-
-  auto lcs =
-      shortestEditScript(src.begin(), src.end(), dst.begin(), dst.end(), ses);
-  std::cout << "LCS: " << lcs << std::endl;
-  std::cout << "SES: " << ses.size() << std::endl;
-  for (const auto &p : ses) {
-    if (p.first == mydiff::ES_RETAIN) {
-      std::cout << "" << src[p.second] << "\n";
-    } else if (p.first == mydiff::ES_DELETE) {
-      // std::cout << "-" << src[p.second] << "\n";
-    } else {
-      // sstd::cout << "+" << dst[p.second] << "\n";
-      std::cout << "" << dst[p.second] << "\n";
+  return 0;
+}
+
+// Renders the runs of one diff as a binary patch or as the text listing.
+template <typename LineVector>
+bool writeResult(const Options &opts, const std::string &srcf,
+                 const std::string &dstf, const mydiff::edit_runs_t &runs,
+                 const int64_t lcs, const LineVector &src,
+                 const LineVector &dst, std::ostream &out) {
+  mydiff::moves_t moves;
+  if (opts.moves) {
+    mydiff::TraceScope trace("moves");
+    mydiff::MoveDetector().detect(runs, src, dst, moves);
+  }
+  mydiff::TraceScope trace("output");
+  if (opts.binary) {
+    return mydiff::BinaryPatch::write(out, srcf, dstf, runs, dst, moves);
+  }
+  uint64_t sesSize = 0;
+  for (const auto &run : runs) {
+    sesSize += run.count;
+  }
+  out << "LCS: " << lcs << "\n";
+  out << "SES: " << sesSize << "\n";
+  // Moves as 1-based source and destination line numbers, `MOVE~` when the
+  // block only matches with blanks ignored.
+  for (const auto &move : moves) {
+    out << (move.exact ? "MOVE: " : "MOVE~: ") << move.srcIndex + 1 << ","
+        << move.count << " " << move.dstIndex + 1 << "\n";
+  }
+  size_t srcIndex = 0, dstIndex = 0;
+  for (const auto &run : runs) {
+    for (uint64_t i = 0; i != run.count; ++i) {
+      if (run.op == mydiff::ES_RETAIN) {
+        out << "" << src[srcIndex++] << "\n";
+        dstIndex += 1;
+      } else if (run.op == mydiff::ES_DELETE) {
+        // out << "-" << src[srcIndex] << "\n";
+        srcIndex += 1;
+      } else {
+        // out << "+" << dst[dstIndex] << "\n";
+        out << "" << dst[dstIndex++] << "\n";
+      }
     }
   }
-  std::cout << std::flush;
+  out << std::flush;
+  return out.good();
+}
+
+// Diffs two line vectors into runs with the engine the options select.
+// `pool` runs anchored segments in parallel; callers that are themselves on
+// a pool pass null.
+template <typename LineVector, typename Engine>
+int64_t computeRuns(const Options &opts, const LineVector &src,
+                    const LineVector &dst, Engine &engine,
+                    mydiff::MonotonicArena &arena, mydiff::ThreadPool *pool,
+                    mydiff::edit_runs_t &runs) {
+  typedef typename LineVector::const_iterator iter_t;
+  typedef mydiff::ArenaAllocator<mydiff::ses_value_t<iter_t>> alloc_t;
+  mydiff::TraceScope trace("diff", "N", src.size(), "M", dst.size());
+  if (opts.anchor) {
+    return mydiff::anchoredEditScript(src.begin(), src.end(), dst.begin(),
+                                      dst.end(), pool, opts.maxMemory, runs);
+  }
+  if (opts.maxMemory != 0) {
+    return mydiff::boundedEditScript(src.begin(), src.end(), dst.begin(),
+                                     dst.end(), opts.maxMemory, runs);
+  }
+  mydiff::ses_t<iter_t, alloc_t> ses((alloc_t(&arena)));
+  int64_t lcs = engine.diff(src.begin(), src.end(), dst.begin(), dst.end(),
+                            ses, std::equal_to<const mydiff::Line *>());
+  mydiff::compactSes(ses, runs);
+  return lcs;
+}
+
+// The --cache directory for the whole process, or null without one.
+std::unique_ptr<mydiff::DiffCache> openDiffCache(const Options &opts) {
+  std::unique_ptr<mydiff::DiffCache> cache;
+  if (!opts.cacheDir.empty()) {
+    cache.reset(new mydiff::DiffCache(opts.cacheDir, opts.cacheSize));
+    if (!cache->open()) {
+      cache.reset();
+    }
+  }
+  return cache;
+}
+
+// Diffs one pair and writes the result to `out`. Batch workers pass their own
+// warm engine and a per-job arena; inputs are then loaded on the calling
+// thread, while a single diff loads both files concurrently.
+bool runDiff(const Options &opts, const std::string &srcf,
+             const std::string &dstf, mydiff::LineInterner &interner,
+             engine_t &engine, mydiff::MonotonicArena &arena,
+             mydiff::ThreadPool *pool, mydiff::DiffCache *cache,
+             const bool batch, std::ostream &out) {
+  // The cache key is made of the digests the loaders take as they read.
+  std::string srcDigest, dstDigest;
+  std::string *srcDigestOut = cache != nullptr ? &srcDigest : nullptr;
+  std::string *dstDigestOut = cache != nullptr ? &dstDigest : nullptr;
+  line_alloc_t lineAlloc(batch ? &arena : nullptr);
+  lines_t src(lineAlloc), dst(lineAlloc);
+  if (batch) {
+    if (!mydiff::LineLoader(interner).load(srcf, src, srcDigestOut) ||
+        !mydiff::LineLoader(interner).load(dstf, dst, dstDigestOut)) {
+      return false;
+    }
+  } else if (!mydiff::LineLoader::load(interner, srcf, src, dstf, dst,
+                                       srcDigestOut, dstDigestOut)) {
+    return false;
+  }
+
+  mydiff::edit_runs_t runs;
+  int64_t cachedLcs = 0;
+  bool cached = false;
+  std::string cacheKey;
+  if (cache != nullptr) {
+    mydiff::TraceScope trace("cache");
+    std::string cacheOptions;
+    if (opts.maxMemory != 0) {
+      cacheOptions = "max-memory=" + std::to_string(opts.maxMemory);
+    }
+    if (opts.anchor) {
+      cacheOptions += cacheOptions.empty() ? "anchor" : ",anchor";
+    }
+    cacheKey = mydiff::DiffCache::makeKey(srcDigest, dstDigest, "myers",
+                                          cacheOptions);
+    cached = cache->lookup(cacheKey, src.size(), dst.size(), runs, cachedLcs);
+  }
+  int64_t lcs;
+  if (cached) {
+    lcs = cachedLcs;
+  } else {
+    lcs = computeRuns(opts, src, dst, engine, arena, pool, runs);
+    if (cache != nullptr) {
+      cache->store(cacheKey, runs, lcs);
+    }
+  }
+  if (!writeResult(opts, srcf, dstf, runs, lcs, src, dst, out)) {
+    return false;
+  }
 
   // for (const auto &p : ses) {
   //   if (p.first == mydiff::ES_DELETE) {
@@ -75,8 +415,792 @@ int main(int argc, char **argv) {
   //   std::cout << src[offset_-1] << "\n";
   // }
   // std::cout << std::flush;
+  return out.good();
+}
+
+// Prints the first `opts.hunks` hunks as `@@ -a,b +c,d @@` headers with
+// 1-based line numbers, followed by their `-` and `+` lines. The script is
+// visited lazily and the search stops once enough hunks are out, so the
+// cost depends on how early the changes are rather than on the whole diff.
+int runHunks(const Options &opts, std::ostream &out) {
+  mydiff::LineInterner interner;
+  lines_t src, dst;
+  if (!mydiff::LineLoader::load(interner, opts.srcf, src, opts.dstf, dst)) {
+    return 1;
+  }
+  uint64_t hunks = 0;
+  uint64_t srcIndex = 0, dstIndex = 0, srcFirst = 0, dstFirst = 0;
+  auto flush = [&]() {
+    if (srcIndex == srcFirst && dstIndex == dstFirst) {
+      return;
+    }
+    out << "@@ -" << srcFirst + 1 << "," << srcIndex - srcFirst << " +"
+        << dstFirst + 1 << "," << dstIndex - dstFirst << " @@\n";
+    for (uint64_t i = srcFirst; i != srcIndex; ++i) {
+      out << "-" << src[i] << "\n";
+    }
+    for (uint64_t i = dstFirst; i != dstIndex; ++i) {
+      out << "+" << dst[i] << "\n";
+    }
+    hunks += 1;
+  };
+  mydiff::TraceScope trace("hunks", "N", src.size(), "M", dst.size());
+  mydiff::visitEditRuns(
+      src.begin(), src.end(), dst.begin(), dst.end(),
+      [&](const mydiff::EDIT_SCRIPT op, const uint64_t count) {
+        if (op == mydiff::ES_DELETE) {
+          srcIndex += count;
+        } else if (op == mydiff::ES_INSERT) {
+          dstIndex += count;
+        } else {
+          flush();
+          srcFirst = srcIndex += count;
+          dstFirst = dstIndex += count;
+        }
+        return hunks != opts.hunks;
+      });
+  if (hunks != opts.hunks) {
+    flush();
+  }
+  out << std::flush;
+  return out.good() ? 0 : 1;
+}
+
+// Prints `D: n`, the number of deleted plus inserted lines, and the LCS
+// based similarity in percent, without computing the script. With --within
+// the search stops once D is known to exceed the limit, `D: >limit` is
+// printed, and the exit status is 0 within the limit and 1 beyond it, as
+// for cmp; errors exit with 2.
+int runDistance(const Options &opts, std::ostream &out) {
+  mydiff::LineInterner interner;
+  lines_t src, dst;
+  if (!mydiff::LineLoader::load(interner, opts.srcf, src, opts.dstf, dst)) {
+    return 2;
+  }
+  mydiff::TraceScope trace("distance", "N", src.size(), "M", dst.size());
+  int64_t lines = src.size() + dst.size();
+  int64_t d = opts.within < 0
+                  ? mydiff::editDistance(src.begin(), src.end(), dst.begin(),
+                                         dst.end())
+                  : mydiff::editDistanceWithin(src.begin(), src.end(),
+                                               dst.begin(), dst.end(),
+                                               opts.within);
+  trace.arg("D", d);
+  if (opts.within >= 0 && d > opts.within) {
+    out << "D: >" << opts.within << std::endl;
+    return out.good() ? 1 : 2;
+  }
+  out << "D: " << d << "\n";
+  out << "similarity: " << (lines == 0 ? 100 : 100 * (lines - d) / lines)
+      << "%" << std::endl;
+  return out.good() ? 0 : 2;
+}
+
+// Diffs two token sequences with the engine the options select.
+template <typename RIter, typename EqualTo, typename Hash>
+int64_t computeTokenRuns(const Options &opts, RIter first1, RIter last1,
+                         RIter first2, RIter last2, mydiff::ThreadPool *pool,
+                         const EqualTo &equalTo, mydiff::edit_runs_t &runs) {
+  mydiff::TraceScope trace("diff", "N", last1 - first1, "M", last2 - first2);
+  if (opts.anchor) {
+    return mydiff::AnchoredDiff<RIter, EqualTo, Hash>(pool, opts.maxMemory,
+                                                      equalTo)
+        .diff(first1, last1, first2, last2, runs);
+  }
+  if (opts.maxMemory != 0) {
+    return mydiff::boundedEditScript(first1, last1, first2, last2,
+                                     opts.maxMemory, runs, equalTo);
+  }
+  mydiff::ses_t<RIter> ses;
+  int64_t lcs =
+      mydiff::shortestEditScript(first1, last1, first2, last2, ses, equalTo);
+  mydiff::compactSes(ses, runs);
+  return lcs;
+}
+
+void writeEscaped(std::ostream &out, const char *data, const size_t size) {
+  static const char hex[] = "0123456789abcdef";
+  for (size_t i = 0; i != size; ++i) {
+    unsigned char c = static_cast<unsigned char>(data[i]);
+    if (c == '\\') {
+      out << "\\\\";
+    } else if (c == '\n') {
+      out << "\\n";
+    } else if (c == '\t') {
+      out << "\\t";
+    } else if (c == '\r') {
+      out << "\\r";
+    } else if (c < 0x20 || c == 0x7f) {
+      out << "\\x" << hex[c >> 4] << hex[c & 15];
+    } else {
+      out.put(static_cast<char>(c));
+    }
+  }
+}
+
+// Prints token runs as byte-range hunks, one per stretch of edits between
+// retained tokens, with 0-based offsets into each file:
+//
+//   @@ -srcOffset,srcLength +dstOffset,dstLength @@
+//   -deleted bytes
+//   +inserted bytes
+//
+// The bytes are escaped C style so every hunk stays on its own lines.
+// `srcOffset(i)` and `dstOffset(i)` give the byte offset of token i.
+template <typename SrcOffset, typename DstOffset>
+bool writeByteHunks(const mydiff::edit_runs_t &runs, const int64_t lcs,
+                    const mydiff::MappedFile &src,
+                    const mydiff::MappedFile &dst, const SrcOffset &srcOffset,
+                    const DstOffset &dstOffset, std::ostream &out) {
+  mydiff::TraceScope trace("output");
+  uint64_t sesSize = 0;
+  for (const auto &run : runs) {
+    sesSize += run.count;
+  }
+  out << "LCS: " << lcs << "\n";
+  out << "SES: " << sesSize << "\n";
+  uint64_t srcIndex = 0, dstIndex = 0;
+  for (size_t i = 0; i != runs.size();) {
+    if (runs[i].op == mydiff::ES_RETAIN) {
+      srcIndex += runs[i].count;
+      dstIndex += runs[i].count;
+      ++i;
+      continue;
+    }
+    uint64_t srcFirst = srcIndex, dstFirst = dstIndex;
+    for (; i != runs.size() && runs[i].op != mydiff::ES_RETAIN; ++i) {
+      (runs[i].op == mydiff::ES_DELETE ? srcIndex : dstIndex) += runs[i].count;
+    }
+    size_t srcBegin = srcOffset(srcFirst), srcEnd = srcOffset(srcIndex);
+    size_t dstBegin = dstOffset(dstFirst), dstEnd = dstOffset(dstIndex);
+    out << "@@ -" << srcBegin << "," << srcEnd - srcBegin << " +" << dstBegin
+        << "," << dstEnd - dstBegin << " @@\n";
+    if (srcEnd != srcBegin) {
+      out << "-";
+      writeEscaped(out, src.data() + srcBegin, srcEnd - srcBegin);
+      out << "\n";
+    }
+    if (dstEnd != dstBegin) {
+      out << "+";
+      writeEscaped(out, dst.data() + dstBegin, dstEnd - dstBegin);
+      out << "\n";
+    }
+  }
+  out << std::flush;
+  return out.good();
+}
+
+// Token mode maps both files and diffs spans over the mappings; byte mode
+// diffs the mapped bytes directly.
+int runTokenDiff(const Options &opts) {
+  mydiff::MappedFile src, dst;
+  if (!src.open(opts.srcf)) {
+    std::cerr << "open error on " << opts.srcf << std::endl;
+    return 1;
+  }
+  if (!dst.open(opts.dstf)) {
+    std::cerr << "open error on " << opts.dstf << std::endl;
+    return 1;
+  }
+  std::ofstream outFile;
+  if (!opts.output.empty()) {
+    outFile.open(opts.output, std::ios::binary);
+    if (!outFile.is_open()) {
+      std::cerr << "open error on " << opts.output << std::endl;
+      return 1;
+    }
+  }
+  std::ostream &out = opts.output.empty() ? std::cout : outFile;
+  std::unique_ptr<mydiff::ThreadPool> pool;
+  if (opts.anchor) {
+    pool.reset(new mydiff::ThreadPool(opts.jobs));
+  }
+  mydiff::edit_runs_t runs;
+  if (opts.tokenizer.mode() == mydiff::TM_BYTES) {
+    const char *first1 = src.data(), *first2 = dst.data();
+    int64_t lcs = computeTokenRuns<const char *, std::equal_to<char>,
+                                   std::hash<char>>(
+        opts, first1, first1 + src.size(), first2, first2 + dst.size(),
+        pool.get(), std::equal_to<char>(), runs);
+    auto offset = [](uint64_t index) { return size_t(index); };
+    return writeByteHunks(runs, lcs, src, dst, offset, offset, out) ? 0 : 1;
+  }
+  mydiff::tokens_t srcTokens, dstTokens;
+  auto split = [&opts](const mydiff::MappedFile &file,
+                       const std::string &name, mydiff::tokens_t &tokens) {
+    if (opts.tokenizer.split(file.data(), file.size(), tokens)) {
+      return true;
+    }
+    std::cerr << "mydiff: " << name << " has a token of 4 GiB or more"
+              << std::endl;
+    return false;
+  };
+  {
+    mydiff::TraceScope trace("split");
+    if (!split(src, opts.srcf, srcTokens) ||
+        !split(dst, opts.dstf, dstTokens)) {
+      return 1;
+    }
+  }
+  int64_t lcs = computeTokenRuns<mydiff::tokens_t::const_iterator,
+                                 mydiff::TokenEqual, mydiff::TokenHash>(
+      opts, srcTokens.begin(), srcTokens.end(), dstTokens.begin(),
+      dstTokens.end(), pool.get(), mydiff::TokenEqual(), runs);
+  auto srcOffset = [&](uint64_t index) {
+    return index == srcTokens.size()
+               ? src.size()
+               : size_t(srcTokens[index].data - src.data());
+  };
+  auto dstOffset = [&](uint64_t index) {
+    return index == dstTokens.size()
+               ? dst.size()
+               : size_t(dstTokens[index].data - dst.data());
+  };
+  return writeByteHunks(runs, lcs, src, dst, srcOffset, dstOffset, out) ? 0
+                                                                          : 1;
+}
+
+// Prints one line per changed file: `A path`, `D path`, `M path`, or
+// `R<score> old new` and `C<score> src new` for renames and copies, with
+// tab separated fields.
+int runTreeDiff(const Options &opts) {
+  mydiff::TreeDiffOptions treeOptions = opts.treeOptions;
+  treeOptions.threads = opts.jobs;
+  mydiff::TreeDiff treeDiff(treeOptions);
+  std::vector<mydiff::TreeChange> changes;
+  if (!treeDiff.diff(opts.srcf, opts.dstf, changes)) {
+    return 1;
+  }
+  for (const auto &change : changes) {
+    switch (change.kind) {
+      case mydiff::TC_ADDED:
+        std::cout << "A\t" << change.dstPath << "\n";
+        break;
+      case mydiff::TC_DELETED:
+        std::cout << "D\t" << change.srcPath << "\n";
+        break;
+      case mydiff::TC_MODIFIED:
+        std::cout << "M\t" << change.dstPath << "\n";
+        break;
+      case mydiff::TC_RENAMED:
+      case mydiff::TC_COPIED:
+        std::cout << (change.kind == mydiff::TC_RENAMED ? "R" : "C")
+                  << std::setw(3) << std::setfill('0') << change.score << "\t"
+                  << change.srcPath << "\t" << change.dstPath << "\n";
+        break;
+    }
+  }
+  std::cout << std::flush;
+  return std::cout.good() ? 0 : 1;
+}
+
+// Quotes a dblisp value the way formatLisp() writes it.
+std::string lispQuoted(const std::string &value) {
+  std::string quoted("\"");
+  for (const char c : value) {
+    if (c == '"') {
+      quoted.push_back('\\');
+    }
+    quoted.push_back(c);
+  }
+  quoted.push_back('"');
+  return quoted;
+}
+
+// Prints the structural diff of two dblisp files, one line per edit: `A
+// path`, `D path` for nodes only on one side, `M path` for a node whose
+// kind changed between values, subtree and empty, and `- path index
+// value`, `+ path index value` for the values of a list, with tab
+// separated fields. A path is `/` for the root, else `/key` per level:
+//
+//   path    = "/" | ("/" segment)+
+//   segment = "\e" | (char | "\\" | "\/" | "\t" | "\n")+
+//
+// where `\e` is the empty key and char is any byte but `\`, `/`, tab and
+// newline.
+int runLispDiff(const Options &opts) {
+  // Arena trees, as they are only read and then dropped whole.
+  dblisp::RecTree src("root", std::make_shared<dblisp::TreeArena>());
+  dblisp::RecTree dst("root", std::make_shared<dblisp::TreeArena>());
+  {
+    mydiff::TraceScope trace("parse");
+    dblisp::DbLispParser parser;
+    if (!parser.lispToRecMap(opts.srcf, src) ||
+        !parser.lispToRecMap(opts.dstf, dst)) {
+      return 1;
+    }
+  }
+  mydiff::LispDiff lispDiff;
+  std::vector<mydiff::LispEdit> edits;
+  lispDiff.diff(src, dst, edits);
+  mydiff::TraceScope trace("output");
+  for (const auto &edit : edits) {
+    switch (edit.op) {
+      case mydiff::LE_ADDED:
+        std::cout << "A\t" << edit.path << "\n";
+        break;
+      case mydiff::LE_DELETED:
+        std::cout << "D\t" << edit.path << "\n";
+        break;
+      case mydiff::LE_REPLACED:
+        std::cout << "M\t" << edit.path << "\n";
+        break;
+      case mydiff::LE_VALUE_DELETED:
+        std::cout << "-\t" << edit.path << "\t" << edit.index << "\t"
+                  << lispQuoted(edit.src->value(edit.index).str()) << "\n";
+        break;
+      case mydiff::LE_VALUE_INSERTED:
+        std::cout << "+\t" << edit.path << "\t" << edit.index << "\t"
+                  << lispQuoted(edit.dst->value(edit.index).str()) << "\n";
+        break;
+    }
+  }
+  std::cout << std::flush;
+  return std::cout.good() ? 0 : 1;
+}
+
+struct BatchEntry {
+  std::string srcf;
+  std::string dstf;
+  std::string output;
+};
+
+bool readManifest(const std::string &manifest,
+                  std::vector<BatchEntry> &entries) {
+  std::ifstream file;
+  if (manifest != "-") {
+    file.open(manifest);
+    if (!file.is_open()) {
+      std::cerr << "open error on " << manifest << std::endl;
+      return false;
+    }
+  }
+  std::istream &in = manifest == "-" ? std::cin : file;
+  std::string line;
+  for (size_t lineNo = 1; getline(in, line); ++lineNo) {
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    // Tab separated when the line has tabs, so paths may contain spaces.
+    std::vector<std::string> fields;
+    char sep = line.find('\t') != std::string::npos ? '\t' : ' ';
+    std::istringstream fieldStream(line);
+    for (std::string field; getline(fieldStream, field, sep);) {
+      if (!field.empty()) fields.push_back(field);
+    }
+    if (fields.size() < 2 || fields.size() > 3) {
+      std::cerr << "mydiff: batch: " << manifest << ":" << lineNo
+                << ": expected `src dst [output]`" << std::endl;
+      return false;
+    }
+    entries.push_back(
+        BatchEntry{fields[0], fields[1], fields.size() == 3 ? fields[2] : ""});
+  }
+  return true;
+}
+
+// Runs `job(entry, worker, arena, out)` for every entry on `pool`. Results
+// without an output file go to stdout behind a `==> src dst <==` header, in
+// entry order unless `tagged` asks for completion order with the entry
+// index in the header.
+template <typename Job>
+int runJobs(const std::vector<BatchEntry> &entries, const bool tagged,
+            mydiff::ThreadPool &pool, const Job &job) {
+  std::vector<std::string> results(entries.size());
+  std::vector<bool> finished(entries.size(), false);
+  size_t nextOrdered = 0;
+  bool failed = false;
+  std::mutex outputMutex;
+  for (size_t index = 0; index != entries.size(); ++index) {
+    pool.submit([&, index](size_t worker) {
+      const BatchEntry &entry = entries[index];
+      mydiff::MonotonicArena arena;
+      bool ok;
+      std::string result;
+      if (entry.output.empty() || entry.output == "-") {
+        std::ostringstream out;
+        ok = job(entry, worker, arena, out);
+        result = out.str();
+      } else {
+        std::ofstream out(entry.output, std::ios::binary);
+        ok = out.is_open() && job(entry, worker, arena, out);
+        if (!out.is_open()) {
+          std::cerr << "open error on " << entry.output << std::endl;
+        }
+      }
+      std::lock_guard<std::mutex> lock(outputMutex);
+      failed = failed || !ok;
+      if (!entry.output.empty() && entry.output != "-") {
+        result.clear();
+      } else if (tagged) {
+        std::cout << "==> [" << index << "] " << entry.srcf << " "
+                  << entry.dstf << " <==\n"
+                  << result;
+        return;
+      } else {
+        result = "==> " + entry.srcf + " " + entry.dstf + " <==\n" + result;
+      }
+      results[index].swap(result);
+      finished[index] = true;
+      for (; nextOrdered != entries.size() && finished[nextOrdered];
+           ++nextOrdered) {
+        std::cout << results[nextOrdered];
+        std::string().swap(results[nextOrdered]);
+      }
+    });
+  }
+  pool.wait();
+  std::cout << std::flush;
+  return failed ? 1 : 0;
+}
+
+// Runs every manifest entry on a fixed pool with one warm engine per worker.
+int runBatch(const Options &opts) {
+  std::vector<BatchEntry> entries;
+  if (!readManifest(opts.manifest, entries)) {
+    return 1;
+  }
+  mydiff::LineInterner interner;
+  mydiff::ThreadPool pool(opts.jobs);
+  std::vector<engine_t> engines(pool.size());
+  std::unique_ptr<mydiff::DiffCache> cache = openDiffCache(opts);
+  return runJobs(entries, opts.tagged, pool,
+                 [&](const BatchEntry &entry, size_t worker,
+                     mydiff::MonotonicArena &arena, std::ostream &out) {
+                   return runDiff(opts, entry.srcf, entry.dstf, interner,
+                                  engines[worker], arena, nullptr,
+                                  cache.get(), true, out);
+                 });
+}
+
+// Diffs --base against every target, with output as for --batch. The base
+// is loaded, interned and indexed once; each target is then loaded on a
+// worker into its job's arena and diffed with that worker's workspace.
+int runBase(const Options &opts) {
+  typedef mydiff::BaseDiff<line_iter, std::equal_to<const mydiff::Line *>>
+      base_diff_t;
+  mydiff::LineInterner interner;
+  lines_t base;
+  if (!mydiff::LineLoader(interner).load(opts.base, base)) {
+    return 1;
+  }
+  base_diff_t baseDiff(base.begin(), base.end(), opts.anchor, opts.maxMemory);
+  mydiff::ThreadPool pool(opts.jobs);
+  std::vector<base_diff_t::Workspace> workspaces(pool.size());
+  std::vector<BatchEntry> entries;
+  for (const auto &target : opts.targets) {
+    entries.push_back(BatchEntry{opts.base, target, ""});
+  }
+  return runJobs(
+      entries, opts.tagged, pool,
+      [&](const BatchEntry &entry, size_t worker,
+          mydiff::MonotonicArena &arena, std::ostream &out) {
+        lines_t dst((line_alloc_t(&arena)));
+        if (!mydiff::LineLoader(interner).load(entry.dstf, dst)) {
+          return false;
+        }
+        mydiff::edit_runs_t runs;
+        int64_t lcs;
+        {
+          mydiff::TraceScope trace("diff", "N", base.size(), "M", dst.size());
+          lcs = baseDiff.diff(dst.begin(), dst.end(), workspaces[worker], runs);
+        }
+        return writeResult(opts, entry.srcf, entry.dstf, runs, lcs, base, dst,
+                           out);
+      });
+}
+
+// Diffs two files held by the server's file cache with the worker's engine.
+bool diffCached(const Options &opts, const mydiff::CachedFile &src,
+                const mydiff::CachedFile &dst, cached_engine_t &engine,
+                std::ostream &out) {
+  mydiff::edit_runs_t runs;
+  mydiff::MonotonicArena arena;
+  int64_t lcs =
+      computeRuns(opts, src.lines, dst.lines, engine, arena, nullptr, runs);
+  if (!opts.binary) {
+    return writeResult(opts, src.path, dst.path, runs, lcs, src.lines,
+                       dst.lines, out);
+  }
+  // The patch describes the contents the runs came from, which the files
+  // on disk may no longer hold.
+  unsigned char srcDigest[mydiff::Sha256::DIGEST_SIZE];
+  unsigned char dstDigest[mydiff::Sha256::DIGEST_SIZE];
+  if (!mydiff::Sha256::fromHex(src.digest, srcDigest, sizeof(srcDigest)) ||
+      !mydiff::Sha256::fromHex(dst.digest, dstDigest, sizeof(dstDigest))) {
+    return false;
+  }
+  mydiff::moves_t moves;
+  if (opts.moves) {
+    mydiff::TraceScope trace("moves");
+    mydiff::MoveDetector().detect(runs, src.lines, dst.lines, moves);
+  }
+  mydiff::TraceScope trace("output");
+  return mydiff::BinaryPatch::write(out, srcDigest, dstDigest,
+                                    dst.noFinalNewline, runs, dst.lines,
+                                    moves);
+}
+
+// One request per connection: a tab separated line, answered by
+// `ERROR <reason>`, or by `OK` and the payload streamed in chunks as it is
+// produced, then a last line: `END`, or `ERROR <reason>` for a failure met
+// after the payload had begun (see SocketStreamBuf::beginChunks()).
+//
+//   DIFF <ref> <ref> [binary] [moves]   the same output as a one-shot run
+//   LOAD <path>                         caches a file, returns its digest
+//   STATS                               cache counters
+//   SHUTDOWN                            stops the server
+//
+// A ref is an absolute path or `sha256:<hex>` of a file already cached.
+void handleRequest(const Options &opts, mydiff::FileCache &files,
+                   cached_engine_t &engine, mydiff::UnixServer &server,
+                   const int fd) {
+  std::string line;
+  if (!mydiff::SocketReader(fd).readLine(line)) {
+    return;
+  }
+  std::vector<std::string> fields;
+  std::istringstream fieldStream(line);
+  for (std::string field; getline(fieldStream, field, '\t');) {
+    fields.push_back(field);
+  }
+  mydiff::SocketStreamBuf buf(fd);
+  std::ostream out(&buf);
+  if (fields.empty()) {
+    out << "ERROR empty request\n";
+  } else if (fields[0] == "DIFF" && fields.size() >= 3) {
+    Options diffOpts = opts;
+    for (size_t i = 3; i != fields.size(); ++i) {
+      if (fields[i] == "binary") {
+        diffOpts.binary = true;
+      } else if (fields[i] == "moves") {
+        diffOpts.moves = true;
+      } else {
+        out << "ERROR unknown option " << fields[i] << "\n";
+        return;
+      }
+    }
+    mydiff::FileCache::file_ptr src, dst;
+    if (!files.get(fields[1], fields[2], src, dst)) {
+      out << "ERROR cannot load " << fields[1] << " or " << fields[2] << "\n";
+      return;
+    }
+    out << "OK\n";
+    buf.beginChunks();
+    bool ok = diffCached(diffOpts, *src, *dst, engine, out);
+    buf.endChunks(ok ? "END" : "ERROR diff failed");
+  } else if (fields[0] == "LOAD" && fields.size() == 2) {
+    mydiff::FileCache::file_ptr file = files.get(fields[1]);
+    if (file == nullptr) {
+      out << "ERROR cannot load " << fields[1] << "\n";
+      return;
+    }
+    out << "OK\n";
+    buf.beginChunks();
+    out << "sha256:" << file->digest << "\n";
+    buf.endChunks("END");
+  } else if (fields[0] == "STATS" && fields.size() == 1) {
+    out << "OK\n";
+    buf.beginChunks();
+    out << "files: " << files.files() << "\nbytes: " << files.bytes()
+        << "\ninterned: " << files.internedLines() << "\n";
+    buf.endChunks("END");
+  } else if (fields[0] == "SHUTDOWN" && fields.size() == 1) {
+    out << "OK\n";
+    buf.beginChunks();
+    buf.endChunks("END");
+    server.stop();
+  } else {
+    out << "ERROR bad request\n";
+  }
+}
+
+mydiff::UnixServer *runningServer = nullptr;
+
+void stopServer(int) { runningServer->stop(); }
+
+int runServer(const Options &opts) {
+  mydiff::FileCache files(opts.fileCacheSize);
+  mydiff::UnixServer server(opts.serve, opts.jobs);
+  if (!server.listen()) {
+    return 1;
+  }
+  std::vector<cached_engine_t> engines(server.workers());
+  runningServer = &server;
+  struct sigaction action;
+  std::memset(&action, 0, sizeof(action));
+  action.sa_handler = stopServer;
+  sigaction(SIGINT, &action, nullptr);
+  sigaction(SIGTERM, &action, nullptr);
+  bool ok = server.serve([&](int fd, size_t worker) {
+    handleRequest(opts, files, engines[worker], server, fd);
+  });
+  runningServer = nullptr;
+  return ok ? 0 : 1;
+}
+
+// Relative paths are resolved here, the server may run elsewhere.
+std::string absoluteRef(const std::string &ref) {
+  if (ref.empty() || ref[0] == '/' || ref.compare(0, 7, "sha256:") == 0) {
+    return ref;
+  }
+  char cwd[PATH_MAX];
+  return getcwd(cwd, sizeof(cwd)) ? std::string(cwd) + "/" + ref : ref;
+}
+
+int runClient(const Options &opts) {
+  std::string request;
+  if (opts.request == "load") {
+    request = "LOAD\t" + absoluteRef(opts.srcf);
+  } else if (opts.request == "stats") {
+    request = "STATS";
+  } else if (opts.request == "shutdown") {
+    request = "SHUTDOWN";
+  } else {
+    request = "DIFF\t" + absoluteRef(opts.srcf) + "\t" + absoluteRef(opts.dstf);
+    request += opts.binary ? "\tbinary" : "";
+    request += opts.moves ? "\tmoves" : "";
+  }
+  int fd = mydiff::UnixServer::connect(opts.connect);
+  if (fd < 0) {
+    return 1;
+  }
+  {
+    mydiff::SocketStreamBuf buf(fd);
+    std::ostream(&buf) << request << "\n" << std::flush;
+  }
+  mydiff::SocketReader reader(fd);
+  std::string status;
+  if (!reader.readLine(status) || status != "OK") {
+    std::cerr << "mydiff: "
+              << (status.empty() ? "no response from server" : status)
+              << std::endl;
+    close(fd);
+    return 1;
+  }
+  std::ofstream outFile;
+  if (!opts.output.empty()) {
+    outFile.open(opts.output, std::ios::binary);
+    if (!outFile.is_open()) {
+      std::cerr << "open error on " << opts.output << std::endl;
+      close(fd);
+      return 1;
+    }
+  }
+  std::ostream &out = opts.output.empty() ? std::cout : outFile;
+  std::string trailer;
+  bool ok = reader.readChunks(out, trailer);
+  close(fd);
+  if (!ok || trailer != "END") {
+    std::cerr << "mydiff: "
+              << (ok ? trailer : "response from server cut short")
+              << std::endl;
+    return 1;
+  }
+  return out.flush().good() ? 0 : 1;
+}
+
+int run(const Options &opts) {
+  if (opts.apply) {
+    return applyPatch(opts);
+  }
+  if (!opts.manifest.empty()) {
+    return runBatch(opts);
+  }
+  if (!opts.base.empty()) {
+    return runBase(opts);
+  }
+  if (opts.tree) {
+    return runTreeDiff(opts);
+  }
+  if (opts.lisp) {
+    return runLispDiff(opts);
+  }
+  if (!opts.serve.empty()) {
+    return runServer(opts);
+  }
+  if (!opts.connect.empty()) {
+    return runClient(opts);
+  }
+  if (opts.tokenizer.mode() != mydiff::TM_LINES) {
+    return runTokenDiff(opts);
+  }
+  std::ofstream outFile;
+  if (!opts.output.empty()) {
+    outFile.open(opts.output, std::ios::binary);
+    if (!outFile.is_open()) {
+      std::cerr << "open error on " << opts.output << std::endl;
+      return 1;
+    }
+  }
+  std::ostream &out = opts.output.empty() ? std::cout : outFile;
+  if (opts.hunks != 0) {
+    return runHunks(opts, out);
+  }
+  if (opts.distance) {
+    return runDistance(opts, out);
+  }
+  mydiff::LineInterner interner;
+  engine_t engine;
+  mydiff::MonotonicArena arena;
+  std::unique_ptr<mydiff::ThreadPool> pool;
+  if (opts.anchor) {
+    pool.reset(new mydiff::ThreadPool(opts.jobs));
+  }
+  std::unique_ptr<mydiff::DiffCache> cache = openDiffCache(opts);
+  return runDiff(opts, opts.srcf, opts.dstf, interner, engine, arena,
+                 pool.get(), cache.get(), false, out)
+             ? 0
+             : 1;
+}
+
+// Tracing is on with --trace, or in production through MYDIFF_TRACE=file,
+// optionally for one run in MYDIFF_TRACE_SAMPLE only. Several processes may
+// share the same MYDIFF_TRACE; the pid is inserted before the extension.
+std::string traceFile(const Options &opts) {
+  if (!opts.trace.empty()) {
+    return opts.trace;
+  }
+  const char *file = std::getenv("MYDIFF_TRACE");
+  if (file == nullptr || *file == '\0') {
+    return "";
+  }
+  const char *sample = std::getenv("MYDIFF_TRACE_SAMPLE");
+  unsigned long rate =
+      sample == nullptr ? 1 : std::strtoul(sample, nullptr, 10);
+  std::hash<uint64_t> hasher;
+  uint64_t seed = getpid() ^ mydiff::Tracer::now();
+  if (rate > 1 && hasher(seed) % rate != 0) {
+    return "";
+  }
+  std::string path(file);
+  size_t dot = path.rfind('.');
+  size_t slash = path.rfind('/');
+  if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) {
+    dot = path.size();
+  }
+  return path.insert(dot, "." + std::to_string(getpid()));
+}
+
+int main(int argc, char **argv) {
+#ifdef GPERF
+  ProfilerStart("mydiff.prof");
+#endif
+  Options opts;
+  if (!parseOptions(argc, argv, opts)) {
+    usage();
+    return 1;
+  }
+  std::string trace = traceFile(opts);
+  if (!trace.empty()) {
+    mydiff::Tracer::enable();
+  }
+  int rc = run(opts);
+  if (!trace.empty() && !mydiff::Tracer::write(trace)) {
+    rc = 1;
+  }
 #ifdef GPERF
   ProfilerStop();
 #endif
-  return 0;
+  return rc;
 }
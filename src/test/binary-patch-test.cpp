@@ -0,0 +1,103 @@
+// Tests of BinaryPatch::apply() on patches that were truncated or tampered
+// with: each must fail, or rebuild the target exactly, and never crash.
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "lib/mydiff/binary-patch.h"
+
+namespace {
+
+int failures = 0;
+
+void check(const bool ok, const std::string& what) {
+  if (!ok) {
+    std::cerr << "FAILED: " << what << std::endl;
+    ++failures;
+  }
+}
+
+void putVarint(std::string& out, uint64_t value) {
+  for (; value >= 0x80; value >>= 7) {
+    out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+  }
+  out.push_back(static_cast<char>(value));
+}
+
+bool apply(const std::string& base, const std::string& patch,
+           std::string& target) {
+  std::istringstream in(patch);
+  std::ostringstream out;
+  bool ok = mydiff::BinaryPatch::apply(base, in, out);
+  target = out.str();
+  return ok;
+}
+
+void testCorruptPatches() {
+  std::string tag = std::to_string(getpid());
+  std::string baseFile = "binary-patch-test.base." + tag;
+  std::string targetFile = "binary-patch-test.target." + tag;
+  std::string targetText = "a\nx\nc";
+  std::ofstream(baseFile) << "a\nb\nc\n";
+  std::ofstream(targetFile) << targetText;
+
+  mydiff::LineInterner interner;
+  std::vector<const mydiff::Line*> target{
+      interner.intern("a", 1), interner.intern("x", 1),
+      interner.intern("c", 1)};
+  mydiff::edit_runs_t runs{{mydiff::ES_RETAIN, 1},
+                           {mydiff::ES_DELETE, 1},
+                           {mydiff::ES_INSERT, 1},
+                           {mydiff::ES_RETAIN, 1}};
+  std::ostringstream patchOut;
+  check(mydiff::BinaryPatch::write(patchOut, baseFile, targetFile, runs,
+                                   target),
+        "write");
+  std::string patch = patchOut.str();
+  std::string output;
+  check(apply(baseFile, patch, output) && output == targetText,
+        "apply of an intact patch");
+
+  for (size_t size = 0; size != patch.size(); ++size) {
+    check(!apply(baseFile, patch.substr(0, size), output),
+          "patch cut to " + std::to_string(size) + " bytes");
+  }
+  for (size_t i = 0; i != patch.size(); ++i) {
+    for (int bits : {0x01, 0x80, 0xff}) {
+      std::string bad = patch;
+      bad[i] = static_cast<char>(bad[i] ^ bits);
+      check(!apply(baseFile, bad, output) || output == targetText,
+            "patch with byte " + std::to_string(i) + " changed");
+    }
+  }
+
+  // Lengths and positions far beyond the input, read before any data.
+  std::string header = patch.substr(0, 4 + 3 + 32);
+  std::string hugeInsert = header;
+  putVarint(hugeInsert, (1 << 2) | 2);
+  putVarint(hugeInsert, 1ULL << 62);
+  check(!apply(baseFile, hugeInsert, output), "insert of 2^62 bytes");
+  std::string hugeRun = header;
+  putVarint(hugeRun, (1ULL << 60) << 2);
+  check(!apply(baseFile, hugeRun, output), "retain of 2^60 lines");
+  std::string farMove = header;
+  putVarint(farMove, (1 << 2) | 3);
+  putVarint(farMove, ~0ULL);
+  check(!apply(baseFile, farMove, output), "move from past the base");
+
+  std::remove(baseFile.c_str());
+  std::remove(targetFile.c_str());
+}
+
+}  // namespace
+
+int main() {
+  testCorruptPatches();
+  return failures == 0 ? 0 : 1;
+}
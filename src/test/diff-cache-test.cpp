@@ -0,0 +1,131 @@
+// Tests of DiffCache lookups of entries that were truncated or tampered
+// with: each must be a miss, never a crash or a wrong script.
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+
+#include "lib/mydiff/diff-cache.h"
+
+namespace {
+
+int failures = 0;
+
+void check(const bool ok, const std::string& what) {
+  if (!ok) {
+    std::cerr << "FAILED: " << what << std::endl;
+    ++failures;
+  }
+}
+
+// The entry header's runCount, after the magic and the version.
+const std::streamoff RUN_COUNT_OFFSET = 8;
+
+void patchRunCount(const std::string& path, uint64_t runCount) {
+  std::fstream entry(path, std::ios::in | std::ios::out | std::ios::binary);
+  entry.seekp(RUN_COUNT_OFFSET);
+  entry.write(reinterpret_cast<const char*>(&runCount), sizeof(runCount));
+}
+
+std::string readFile(const std::string& file) {
+  std::ifstream in(file, std::ios::binary);
+  return std::string(std::istreambuf_iterator<char>(in),
+                     std::istreambuf_iterator<char>());
+}
+
+void writeFile(const std::string& file, const std::string& entry) {
+  std::ofstream(file, std::ios::binary | std::ios::trunc) << entry;
+}
+
+// Sums what `runs` consume of the source and of the destination.
+void consumed(const mydiff::edit_runs_t& runs, uint64_t& src, uint64_t& dst) {
+  src = dst = 0;
+  for (const auto& run : runs) {
+    src += run.op != mydiff::ES_INSERT ? run.count : 0;
+    dst += run.op != mydiff::ES_DELETE ? run.count : 0;
+  }
+}
+
+void testRunCount() {
+  std::string dir = "diff-cache-test." + std::to_string(getpid());
+  mydiff::DiffCache cache(dir, 1 << 20);
+  check(cache.open(), "open");
+  std::string key = mydiff::DiffCache::makeKey("a", "b", "myers", "");
+  std::string path = dir + "/" + key + ".ses";
+  mydiff::edit_runs_t runs{{mydiff::ES_RETAIN, 2},
+                           {mydiff::ES_DELETE, 1},
+                           {mydiff::ES_INSERT, 3}};
+  check(cache.store(key, runs, 2), "store");
+
+  mydiff::edit_runs_t found;
+  int64_t lcs = 0;
+  check(cache.lookup(key, 3, 5, found, lcs) && found.size() == 3 && lcs == 2,
+        "lookup of an intact entry");
+
+  // Multiplied by the record size, this count wraps to the file's size.
+  patchRunCount(path, 3 + (1ULL << 60));
+  found.clear();
+  check(!cache.lookup(key, 3, 5, found, lcs) && found.empty(),
+        "runCount that overflows the size check");
+  patchRunCount(path, 2);
+  check(!cache.lookup(key, 3, 5, found, lcs), "runCount short of the file");
+  patchRunCount(path, 3);
+  check(cache.lookup(key, 3, 5, found, lcs), "lookup after restoring");
+
+  std::remove(path.c_str());
+  rmdir(dir.c_str());
+}
+
+// Every cut or changed byte is a miss, or a hit whose runs still fit the
+// inputs exactly.
+void testCorruptEntries() {
+  std::string dir = "diff-cache-test." + std::to_string(getpid());
+  mydiff::DiffCache cache(dir, 1 << 20);
+  check(cache.open(), "open");
+  std::string key = mydiff::DiffCache::makeKey("c", "d", "myers", "");
+  std::string path = dir + "/" + key + ".ses";
+  mydiff::edit_runs_t runs{{mydiff::ES_RETAIN, 2},
+                           {mydiff::ES_DELETE, 1},
+                           {mydiff::ES_INSERT, 3}};
+  check(cache.store(key, runs, 2), "store");
+  std::string entry = readFile(path);
+
+  mydiff::edit_runs_t found;
+  int64_t lcs = 0;
+  uint64_t src, dst;
+  for (size_t size = 0; size != entry.size(); ++size) {
+    writeFile(path, entry.substr(0, size));
+    check(!cache.lookup(key, 3, 5, found, lcs),
+          "entry cut to " + std::to_string(size) + " bytes");
+  }
+  for (size_t i = 0; i != entry.size(); ++i) {
+    for (int bits : {0x01, 0x80, 0xff}) {
+      std::string bad = entry;
+      bad[i] = static_cast<char>(bad[i] ^ bits);
+      writeFile(path, bad);
+      found.clear();
+      bool hit = cache.lookup(key, 3, 5, found, lcs);
+      consumed(found, src, dst);
+      check(!hit || (src == 3 && dst == 5),
+            "entry with byte " + std::to_string(i) + " changed");
+    }
+  }
+  writeFile(path, entry);
+  check(!cache.lookup(key, 4, 5, found, lcs), "hit for other line counts");
+  check(cache.lookup(key, 3, 5, found, lcs), "lookup after restoring");
+
+  std::remove(path.c_str());
+  rmdir(dir.c_str());
+}
+
+}  // namespace
+
+int main() {
+  testRunCount();
+  testCorruptEntries();
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,189 @@
+// Tests of RecTree copies, which share children until written: neither
+// tree sees the other's writes, and references taken as documented stay
+// valid whichever tree goes first.
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "lib/recursiveTree/dblisp-parser.h"
+#include "lib/recursiveTree/recursive-map.h"
+
+namespace {
+
+int failures = 0;
+
+void check(const bool ok, const std::string& what) {
+  if (!ok) {
+    std::cerr << "FAILED: " << what << std::endl;
+    ++failures;
+  }
+}
+
+size_t values(const dblisp::RecTree& tree, const char* key1,
+              const char* key2) {
+  return tree.at(key1).at(key2).valueCount();
+}
+
+// Copy, then take a reference into the source, write through it and
+// through the source, then drop the copy and keep using the reference.
+void testCopyThenWrite(const dblisp::CHILD_STORAGE storage) {
+  dblisp::RecTree config("root", nullptr, storage);
+  config["db"]["pool"].pushValue("4");
+  config["db"]["host"].pushValue("a");
+  config["web"].pushValue("x");
+  std::string before = config.formatLisp();
+  {
+    dblisp::RecTree snap(config);
+    dblisp::RecTree& db = config.at("db");
+    config["web"].pushValue("y");
+    db["pool"].pushValue("8");
+    check(&db == &config.at("db"), "reference moved out of the live tree");
+    check(values(config, "db", "pool") == 2 &&
+              config.at("db").at("pool").value(1).str() == "8",
+          "write through a reference missed the live tree");
+    check(config.at("web").valueCount() == 2, "live write lost");
+    check(snap.formatLisp() == before, "write reached the copy");
+
+    dblisp::RecTree& snapHost = snap["db"]["host"];
+    snapHost.pushValue("b");
+    check(values(snap, "db", "host") == 2, "copy lost its own write");
+    check(values(config, "db", "host") == 1, "copy's write reached the tree");
+  }
+  config.at("db")["pool"].pushValue("16");
+  check(values(config, "db", "pool") == 3,
+        "reference broken by dropping the copy");
+
+  // Erase through an iterator of the const tree while it is shared.
+  dblisp::RecTree copy(config);
+  const dblisp::RecTree& constConfig = config;
+  config.erase(constConfig.find("web"));
+  check(config.find("web") == config.end() && copy.find("web") != copy.end(),
+        "erase through a shared const iterator");
+}
+
+// Subtree variables are expanded as shared copies, which the parser then
+// writes into without changing the variable's tree.
+void testVariableExpansion() {
+  std::string file = "recursive-map-test." + std::to_string(getpid());
+  std::ofstream(file) << "(\"t\" (\"k\" \"1\") (\"m\" \"2\"))\n"
+                         "(\"u\" (t) (\"n\" \"3\"))\n"
+                         "(\"w\" (t))\n";
+  dblisp::RecTree tree("root", nullptr, dblisp::FLAT_CHILDREN);
+  dblisp::DbLispParser parser;
+  check(parser.lispToRecMap(file, tree), "parse of variables");
+  std::remove(file.c_str());
+  check(tree.childStorage() == dblisp::FLAT_CHILDREN &&
+            tree.at("u").at("t").childStorage() == dblisp::FLAT_CHILDREN,
+        "parse into a flat tree changed its storage");
+  tree.at("u").at("t")["k"].pushValue("9");
+  check(values(tree, "t", "k") == 1 &&
+            tree.at("w").at("t").at("k").valueCount() == 1,
+        "write to an expansion reached the variable");
+  check(tree.at("u").at("t").at("k").valueCount() == 2,
+        "write to an expansion lost");
+  check(tree.at("u").at("n").valueCount() == 1, "expansion sibling lost");
+}
+
+// A KeyPath returns the node it remembers only while no tree has changed
+// shape, and never one shared with a copy for writing.
+void testKeyPath(const dblisp::CHILD_STORAGE storage) {
+  dblisp::RecTree config("root", nullptr, storage);
+  config["db"]["pool"].pushValue("4");
+  dblisp::KeyPath pool = dblisp::RecTree::splitPath("db/pool");
+  check(&config.at(pool) == &config.at("db").at("pool"), "path lookup");
+  check(&config.at(pool) == &config.at("db").at("pool"), "remembered lookup");
+
+  // Flat children move when a key is inserted before them.
+  config["a"].pushValue("1");
+  config["db"]["a"].pushValue("1");
+  check(&config.at(pool) == &config.at("db").at("pool"),
+        "lookup after inserts");
+  config.at("db").erase("pool");
+  check(config.findPath(pool) == nullptr, "lookup after erase");
+  config["db"]["pool"].pushValue("8");
+  check(config.at(pool).value().str() == "8", "lookup after re-insert");
+
+  const dblisp::RecTree& constConfig = config;
+  check(&constConfig.at(pool) == &config.at("db").at("pool"),
+        "const lookup");
+  dblisp::RecTree copy(config);
+  config.at(pool).pushValue("16");
+  check(copy.at(pool).valueCount() == 1, "write through a path reached copy");
+  check(config.at(pool).valueCount() == 2, "write through a path lost");
+
+  dblisp::RecTree other(config);
+  check(&other.at(pool) == &other.at("db").at("pool"),
+        "lookup from another tree");
+
+  // Every separator separates, so empty keys can be addressed.
+  config[""]["x"][""].pushValue("e");
+  check(dblisp::RecTree::splitPath("/x/").size() == 3 &&
+            config.at(dblisp::RecTree::splitPath("/x/")).value().str() == "e",
+        "path with empty keys");
+  check(dblisp::RecTree::splitPath("").size() == 0 &&
+            &config.at(dblisp::RecTree::splitPath("")) == &config,
+        "empty path");
+}
+
+// Copies read and written on several threads, each copy by one of them,
+// while all share the nodes of one tree.
+void testThreads() {
+  dblisp::RecTree config("root");
+  for (int i = 0; i != 100; ++i) {
+    dblisp::RecTree& group = config[std::to_string(i)];
+    for (int j = 0; j != 10; ++j) {
+      group[std::to_string(j)].pushValue(std::to_string(i * 10 + j));
+    }
+  }
+  std::string before = config.formatLisp();
+  std::atomic<int> wrong(0);
+  std::vector<std::thread> threads;
+  for (int t = 0; t != 4; ++t) {
+    threads.emplace_back([&config, &wrong, t]() {
+      dblisp::RecTree copy(config);
+      for (int round = 0; round != 10; ++round) {
+        const dblisp::RecTree& reader = copy;
+        for (const auto& group : reader) {
+          for (const auto& child : group) {
+            if (child.key().str() == "x") {
+              continue;
+            }
+            const std::vector<dblisp::ValType>& values = child.valueVector();
+            unsigned long long number;
+            if (values.empty() || !values[0].asULLInt(number) ||
+                number % 10 != std::stoull(child.key().str())) {
+              ++wrong;
+            }
+          }
+        }
+        copy[std::to_string(round * 10 + t)]["x"].pushValue("w");
+      }
+      if (copy.size() != 100 || copy.at("0").size() != 10 + (t == 0)) {
+        ++wrong;
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  check(wrong == 0, "copies used on several threads");
+  check(config.formatLisp() == before, "threads' writes reached the tree");
+}
+
+}  // namespace
+
+int main() {
+  testCopyThenWrite(dblisp::MAP_CHILDREN);
+  testCopyThenWrite(dblisp::FLAT_CHILDREN);
+  testVariableExpansion();
+  testKeyPath(dblisp::MAP_CHILDREN);
+  testKeyPath(dblisp::FLAT_CHILDREN);
+  testThreads();
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,129 @@
+// Tests of TreeSnapshot on images that were truncated or tampered with:
+// open() must reject any whose tables do not fill the file, and verify()
+// any whose records point outside their tables, so that every image that
+// passes both can be walked without leaving the mapping.
+#include <unistd.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+
+#include "lib/recursiveTree/tree-snapshot.h"
+
+namespace {
+
+int failures = 0;
+
+void check(const bool ok, const std::string& what) {
+  if (!ok) {
+    std::cerr << "FAILED: " << what << std::endl;
+    ++failures;
+  }
+}
+
+// The header: magic, version and three 64-bit table sizes.
+const size_t HEADER_SIZE = 32;
+
+std::string readFile(const std::string& file) {
+  std::ifstream in(file, std::ios::binary);
+  return std::string(std::istreambuf_iterator<char>(in),
+                     std::istreambuf_iterator<char>());
+}
+
+void writeFile(const std::string& file, const std::string& image) {
+  std::ofstream(file, std::ios::binary) << image;
+}
+
+// Touches every key and value, and looks every child up again by key.
+size_t walk(const dblisp::TreeView& view) {
+  size_t bytes = view.key().size();
+  for (size_t i = 0; i != view.valueCount(); ++i) {
+    bytes += view.value(i).str().size();
+  }
+  for (const auto& child : view) {
+    bytes += walk(child);
+    view.find(child.key());
+  }
+  return bytes;
+}
+
+// Opens and verifies `image`, and walks it if both pass.
+bool accepts(const std::string& file, const std::string& image) {
+  writeFile(file, image);
+  dblisp::TreeSnapshot snapshot;
+  if (!snapshot.open(file) || !snapshot.verify()) {
+    return false;
+  }
+  walk(snapshot.root());
+  return true;
+}
+
+template <typename Int>
+void setNodeField(std::string& image, const size_t index,
+                  const size_t offset, const Int value) {
+  size_t at = HEADER_SIZE + index * sizeof(dblisp::SnapshotNode) + offset;
+  std::memcpy(&image[at], &value, sizeof(value));
+}
+
+void testCorruptImages() {
+  std::string file = "tree-snapshot-test." + std::to_string(getpid());
+  dblisp::RecTree tree("root");
+  tree["db"]["pool"].pushValue("4");
+  tree["db"]["host"].pushValue("a");
+  tree["db"]["host"].pushValue("b");
+  tree["web"]["port"].pushValue("80");
+  tree["empty"];
+  check(dblisp::TreeSnapshot::compile(tree, file), "compile");
+  std::string image = readFile(file);
+  {
+    dblisp::TreeSnapshot snapshot;
+    check(snapshot.open(file) && snapshot.verify() &&
+              snapshot.root().at("db").at("host").value(1).str() == "b",
+          "open of an intact image");
+  }
+
+  for (size_t size = 0; size != image.size(); ++size) {
+    writeFile(file, image.substr(0, size));
+    check(!dblisp::TreeSnapshot().open(file),
+          "image cut to " + std::to_string(size) + " bytes");
+  }
+  size_t rejected = 0;
+  for (size_t i = 0; i != image.size(); ++i) {
+    for (int bits : {0x01, 0x80, 0xff}) {
+      std::string bad = image;
+      bad[i] = static_cast<char>(bad[i] ^ bits);
+      rejected += !accepts(file, bad);
+    }
+  }
+  check(rejected != 0, "no changed image rejected");
+
+  std::string loop = image;
+  setNodeField(loop, 0, offsetof(dblisp::SnapshotNode, first), uint64_t(0));
+  check(!accepts(file, loop), "root that is its own child");
+  std::string farKey = image;
+  setNodeField(farKey, 1, offsetof(dblisp::SnapshotNode, key),
+               uint64_t(1) << 40);
+  check(!accepts(file, farKey), "key past the string table");
+  std::string farChildren = image;
+  setNodeField(farChildren, 0, offsetof(dblisp::SnapshotNode, count),
+               ~uint64_t(0));
+  check(!accepts(file, farChildren), "children past the node table");
+  std::string badType = image;
+  setNodeField(badType, 0, offsetof(dblisp::SnapshotNode, type),
+               uint32_t(7));
+  check(!accepts(file, badType), "unknown node type");
+
+  std::remove(file.c_str());
+}
+
+}  // namespace
+
+int main() {
+  testCorruptImages();
+  return failures == 0 ? 0 : 1;
+}